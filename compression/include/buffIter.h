@@ -11,13 +11,18 @@
  * @brief Structure for iterating through a buffer bit-by-bit.
  *
  * This structure holds the necessary information to traverse a byte buffer,
- * extracting bits based on a specified step size (key size).
+ * extracting bits based on a specified step size (key size). Bits are served
+ * from a 64-bit register refilled with one unaligned load per refill, and
+ * never read past the end of the buffer.
  */
 struct buffIter {
 	unsigned char *buff;            /**< Pointer to the buffer being iterated. */
 	unsigned long buffSize;         /**< Size of the buffer in bytes. */
 	unsigned long currBit;          /**< Current bit position within the buffer. */
 	unsigned long stepSize;         /**< Number of bits to extract in each step (key size). */
+	uint64_t bitBuf;                /**< Next bits of the buffer, MSB first. */
+	unsigned int bitCount;          /**< Number of valid bits in bitBuf. */
+	unsigned long nextByte;         /**< Next byte to load into bitBuf. */
 };
 
 /**
@@ -66,6 +71,20 @@ bool iterHasNext(struct buffIter *iter);
  */
 void advance(struct buffIter *iter, uint64_t *result);
 
+/**
+ * @brief Extracts the next keys from the buffer in one call.
+ *
+ * Keys are returned left-aligned, like advance() does. A last key cut by the
+ * end of the buffer is padded with zeros.
+ *
+ * @param iter Pointer to the buffIter structure.
+ * @param keys Array receiving the keys.
+ * @param n Maximum number of keys to extract.
+ * @return Number of keys extracted, less than n only at the end of the buffer.
+ */
+unsigned long advanceBatch(struct buffIter *iter, uint64_t *keys,
+			   unsigned long n);
+
 /**
  * @brief Calculates the number of unused bits at the end of the buffer.
  *
@@ -3,53 +3,112 @@
 /*
  * Header file for compression utility functions.
  *
- * This header defines functions and constants used for compressing data
- * and writing metadata. It provides functions for initializing meta and
- * data files, and for getting the size of a file.
+ * This header defines the functions shared by the serial and the parallel
+ * compressors: compressing a buffer into an archive chunk, getting the size
+ * of a file and reading a byte range of it.
  */
 
-// #include <fcntl.h>
-// #include <inttypes.h>
-// #include <mpi.h>
-// #include <stdio.h>
-// #include <stdlib.h>
-// #include <string.h>
-// #include <sys/stat.h>
-// #include <sys/types.h>
-
-// #include "buffIter.h"
-// #include "common.h"
-// #include "writeBuff.h"
-
 #ifndef COMPRESSOR_H
 #define COMPRESSOR_H
 
 #include <stdio.h>
 
-// static const char data[5] = ".data";
-// static const char meta[5] = ".meta";
+#include "container.h"
 
-// // Used to convert integers to strings
-// char num[20];
+/**
+ * @brief Keys at the edges of one chunk-sized piece of the input.
+ *
+ * Used to stitch runs across chunk boundaries, also when the neighbouring
+ * piece belongs to another rank.
+ */
+struct chunkEdge {
+	uint64_t firstKey;      /**< First key of the piece. */
+	uint64_t lastKey;       /**< Last key of the piece. */
+	uint64_t leadRun;       /**< Whole keys in the leading run, rounded down to a byte boundary. */
+	uint64_t keySize;       /**< Size of the keys the piece is cut into. */
+};
+
+// Key size asking for every chunk to pick its own, see pickKeySize()
+#define ADAPTIVE_KEY_SIZE 0
 
 /**
- * @brief Initializes the metadata file with process, run count, and run length info.
+ * @brief Gets the number of input bytes compressed into a chunk.
+ *
+ * DEFAULT_CHUNK_SIZE rounded down to a whole number of keys, so that keys
+ * never straddle chunk boundaries. With ADAPTIVE_KEY_SIZE, a whole number
+ * of keys of any size pickKeySize() may choose.
  *
- * @param metaFile Pointer to the metadata file.
- * @param lengthOfRunInBits Length of a run in bits.
- * @param numRuns Total number of runs.
- * @param numDprocs Number of decompression processes.
+ * @param keySize Size of the keys in bits, or ADAPTIVE_KEY_SIZE.
+ * @return Size in bytes of every chunk but the last one.
  */
-void initMetaFile(FILE *metaFile, unsigned int lengthOfRunInBits,
-		  unsigned long numRuns, unsigned int numDprocs);
+unsigned long chunkBytes(unsigned int keySize);
 
 /**
- * @brief Initializes the data file with the key size.
+ * @brief Gets the edges of a chunk-sized piece of the input.
  *
- * @param dataFile Pointer to the data file.
- * @param keySize Size of the key.
+ * The leading run is left at 0 when it cannot join the previous piece, so
+ * it is only scanned for when stitching may happen.
+ *
+ * @param buffer Bytes of the piece.
+ * @param size Number of bytes in the piece.
+ * @param keySize Size of the keys in bits.
+ * @param prev Edges of the previous piece, or NULL if they are not known.
+ * @param edge Edges to fill in.
  */
-void initDataFile(FILE *dataFile, unsigned int keySize);
+void getChunkEdge(unsigned char *buffer, unsigned long size,
+		  unsigned int keySize, const struct chunkEdge *prev,
+		  struct chunkEdge *edge);
+
+/**
+ * @brief Gets how many leading keys of a piece join the chunk before it.
+ *
+ * A run crossing a chunk boundary is kept whole in the earlier chunk, as
+ * far as the boundary can move while staying on a byte boundary. Pieces cut
+ * into keys of different sizes are never stitched.
+ *
+ * @param prev Edges of the previous piece.
+ * @param edge Edges of the piece.
+ * @return Number of keys moved to the previous chunk.
+ */
+uint64_t stitchedKeys(struct chunkEdge *prev, struct chunkEdge *edge);
+
+/**
+ * @brief Picks the key size compressing a piece of the input best.
+ *
+ * A few windows spread over the piece are compressed with every candidate
+ * size, 8, 16, 32 and 64 bits, and the size giving the smallest chunks wins,
+ * leaving the Huffman stage out.
+ * On a tie the larger keys win, as they decode faster.
+ *
+ * @param buffer Bytes of the piece.
+ * @param size Number of bytes in the piece.
+ * @return The key size in bits.
+ */
+unsigned int pickKeySize(unsigned char *buffer, unsigned long size);
+
+/**
+ * @brief Compresses a chunk-sized piece of the input into an archive chunk.
+ *
+ * The buffer is split into keys of keySize bits, the last one padded with
+ * zeros if keySize does not divide it, and every run of equal keys is stored
+ * as one key in the key stream and its length in the count stream. The
+ * first skipKeys keys were stitched to the previous chunk and are left out,
+ * while extraKeys more copies of the last key, stitched from the next
+ * piece, are added. With useEntropy set, each stream also goes through the
+ * Huffman stage if that makes it smaller.
+ *
+ * @param buffer Bytes of the piece.
+ * @param size Number of bytes in the piece.
+ * @param keySize Size of the keys in bits.
+ * @param skipKeys Leading keys moved to the previous chunk.
+ * @param extraKeys Leading keys of the next piece moved to this chunk.
+ * @param useEntropy Whether to try the Huffman stage on both streams.
+ * @param out Chunk receiving the compressed bytes, to be freed by the caller.
+ * @return 0 on success, -1 on error.
+ */
+int compressChunk(unsigned char *buffer, unsigned long size,
+		  unsigned int keySize, uint64_t skipKeys, uint64_t extraKeys,
+		  int useEntropy, struct chunk *out);
 
 /**
  * @brief Gets the size of a file.
@@ -59,6 +118,32 @@ void initDataFile(FILE *dataFile, unsigned int keySize);
  */
 unsigned long getFileSize(char *filename);
 
+/**
+ * @brief Reads a byte range of a file with pread().
+ *
+ * Used as the fallback when the input cannot be mapped or read through
+ * MPI-IO.
+ *
+ * @param filename Name of the file.
+ * @param offset Offset of the first byte to read.
+ * @param size Number of bytes to read.
+ * @param buffer Buffer of at least size bytes receiving the data.
+ * @return 0 on success, -1 on error.
+ */
+int readFileRange(char *filename, unsigned long offset, unsigned long size,
+		  unsigned char *buffer);
+
+/**
+ * @brief Gets the default archive name for an input file.
+ *
+ * The file name with everything from its first '.' replaced by ".rle", so
+ * "dir/data.tar.gz" gives "dir/data.rle".
+ *
+ * @param inputName Name of the input file.
+ * @return Archive name, to be freed by the caller, NULL if out of memory.
+ */
+char *archiveName(const char *inputName);
+
 // "You are on this council but we do not grant you the rank of master."
 #define MASTER_RANK 0
 
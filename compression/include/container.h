@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: GPL-3.0 */
+
+/*
+ * Layout of a compressed archive.
+ *
+ * An archive is a single file made of a header, a sequence of independently
+ * decodable chunks and a trailing index:
+ *
+ *   header  | "RLEC" | version (8) | keySize (8) | reserved (16) |
+ *   chunk   | chunk header | count stream | key stream |
+ *   ...
+ *   index   | offset (64) | numRuns (64) | rawSize (64) |  one per chunk
+ *   trailer | index offset (64) | numChunks (64) | "RLEINDEX" |
+ *
+ * A chunk header holds the key size, the width of a run length in bits, how
+ * the count stream is coded, the number of runs and the size in bytes of the
+ * count and key streams:
+ *
+ *   | keySize (8) | runLen (8) | countCoding (8) | entropy (8) |
+ *   | paletteSize (16) | reserved (16) |
+ *   | numRuns (64) | count stream bytes (64) | key stream bytes (64) |
+ *
+ * The count stream holds every run length at runLen bits (COUNTS_FIXED) or
+ * in blocks of COUNT_BLOCK values, each with its own width (COUNTS_BLOCKED):
+ *
+ *   | width (8) | numExceptions (8) | exceptionWidth (8) |
+ *   | position (7) | value >> width (exceptionWidth) |  one per exception
+ *   | value (width) |  one per value, the low bits only
+ *
+ * padded to a byte. Values needing more than width bits are exceptions,
+ * patched from their high bits. The compressors pack every block as soon as
+ * its runs are found, so they only write blocked counts, fixed-width ones
+ * being left to older archives. The key size in the archive header is 0
+ * when every chunk picked its own.
+ *
+ * A chunk with a palette starts its key stream with the paletteSize keys of
+ * the palette, then gives every key as its index in the palette, at the
+ * fewest bits telling them all apart, see palette.h.
+ *
+ * The entropy flags tell which streams went through the Huffman stage, see
+ * huffman.h, the stream sizes in the header being those of the coded
+ * streams. All integers are stored big-endian.
+ */
+
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define CONTAINER_MAGIC "RLEC"
+#define CONTAINER_VERSION 2
+#define TRAILER_MAGIC "RLEINDEX"
+
+#define CONTAINER_HEADER_SIZE 8
+#define CHUNK_HEADER_SIZE 32
+#define INDEX_ENTRY_SIZE 24
+#define TRAILER_SIZE 24
+
+// Coding of the count stream of a chunk, only COUNTS_BLOCKED is written
+#define COUNTS_FIXED 0
+#define COUNTS_BLOCKED 1
+
+// Number of run lengths in a block of a COUNTS_BLOCKED count stream
+#define COUNT_BLOCK 128
+
+// Entropy flags of a chunk, set for each Huffman coded stream
+#define ENTROPY_META 1
+#define ENTROPY_DATA 2
+
+// Most keys a chunk palette may hold
+#define PALETTE_MAX 4096
+
+// Longest Huffman code, and size of the stream size and code lengths
+// leading a Huffman coded stream
+#define HUFFMAN_MAX_BITS 12
+#define HUFFMAN_HEADER_SIZE (8 + 256 / 2)
+
+// Number of input bytes compressed into a single chunk
+#ifndef DEFAULT_CHUNK_SIZE
+#define DEFAULT_CHUNK_SIZE (64UL << 20)
+#endif
+
+/**
+ * @brief Index entry describing one chunk of the archive.
+ */
+struct chunkInfo {
+	uint64_t offset;        /**< Offset of the chunk from the start of the archive. */
+	uint64_t numRuns;       /**< Number of runs stored in the chunk. */
+	uint64_t rawSize;       /**< Size in bytes of the chunk once decompressed. */
+};
+
+/**
+ * @brief A compressed chunk held in memory, ready to be written out.
+ */
+struct chunk {
+	unsigned char *bytes;   /**< Chunk header followed by the count and key streams. */
+	uint64_t size;          /**< Size of bytes. */
+	struct chunkInfo info;  /**< Index entry of the chunk, offset is set by the caller. */
+};
+
+/**
+ * @brief Fills in the archive header.
+ *
+ * @param out Buffer of at least CONTAINER_HEADER_SIZE bytes.
+ * @param keySize Size of the keys in bits.
+ */
+void makeContainerHeader(unsigned char *out, unsigned int keySize);
+
+/**
+ * @brief Fills in the header of a chunk.
+ *
+ * @param out Buffer of at least CHUNK_HEADER_SIZE bytes.
+ * @param keySize Size of the keys in bits.
+ * @param runLen Width of a run length in bits, 0 for blocked counts.
+ * @param countCoding Coding of the count stream, COUNTS_FIXED or COUNTS_BLOCKED.
+ * @param entropy Entropy flags, which streams are Huffman coded.
+ * @param paletteSize Number of keys in the palette of the chunk, 0 for none.
+ * @param numRuns Number of runs in the chunk.
+ * @param metaBytes Size of the count stream in bytes.
+ * @param dataBytes Size of the key stream in bytes.
+ */
+void makeChunkHeader(unsigned char *out, unsigned int keySize,
+		     unsigned int runLen, unsigned int countCoding,
+		     unsigned int entropy, unsigned int paletteSize,
+		     uint64_t numRuns, uint64_t metaBytes, uint64_t dataBytes);
+
+/**
+ * @brief Serializes the chunk index followed by the trailer.
+ *
+ * @param out Buffer of at least numChunks * INDEX_ENTRY_SIZE + TRAILER_SIZE bytes.
+ * @param index Index entries, in archive order.
+ * @param numChunks Number of chunks.
+ * @param indexOffset Offset at which the index is written in the archive.
+ */
+void makeIndex(unsigned char *out, struct chunkInfo *index,
+	       uint64_t numChunks, uint64_t indexOffset);
+
+/**
+ * @brief Writes the chunk index and trailer to a file.
+ *
+ * @param file File positioned at indexOffset.
+ * @param index Index entries, in archive order.
+ * @param numChunks Number of chunks.
+ * @param indexOffset Offset at which the index is written in the archive.
+ * @return 0 on success, -1 on error.
+ */
+int writeIndex(FILE *file, struct chunkInfo *index, uint64_t numChunks,
+	       uint64_t indexOffset);
+
+#endif // CONTAINER_H
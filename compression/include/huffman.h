@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-3.0 */
+
+/*
+ * Optional entropy stage over the streams of a chunk.
+ *
+ * A stream is coded byte by byte with a canonical Huffman code built for it
+ * alone, code lengths capped at HUFFMAN_MAX_BITS so that the decoder can
+ * resolve every code, often two, with a single table lookup.
+ */
+
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * @brief Huffman codes a stream.
+ *
+ * The coded stream holds the size of the stream (64 bits), the code length
+ * of every byte value (4 bits each) and the codes, MSB first.
+ *
+ * @param in Bytes of the stream.
+ * @param size Size of the stream in bytes.
+ * @param out Receives the coded stream, to be freed by the caller.
+ * @param outSize Receives the size of the coded stream.
+ * @return 0 if the coded stream is smaller than the stream, -1 otherwise or on error.
+ */
+int huffmanEncode(const unsigned char *in, size_t size, unsigned char **out,
+		  size_t *outSize);
+
+#endif // HUFFMAN_H
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-3.0 */
+
+/*
+ * Palette of the distinct keys of a chunk.
+ *
+ * Keys are gathered in a small open addressing hash set while the chunk is
+ * scanned. A chunk using at most PALETTE_MAX distinct keys can then store
+ * each of them once and write indices into that palette, a few bits each,
+ * in place of the keys in its key stream.
+ */
+
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "container.h"
+
+// Slots of the hash set, twice the number of keys it may hold
+#define PALETTE_SLOTS (2 * PALETTE_MAX)
+
+/**
+ * @brief Distinct keys seen so far in a chunk.
+ */
+struct palette {
+	uint64_t keys[PALETTE_MAX];     /**< Distinct keys, right-aligned, in order of appearance. */
+	uint16_t slots[PALETTE_SLOTS];  /**< One more than the index of the key in each slot, 0 if empty. */
+	unsigned int keySize;           /**< Bit length of a key. */
+	unsigned int size;              /**< Number of distinct keys. */
+	unsigned int maxSize;           /**< Most keys whose indices are still shorter than the keys. */
+	int full;                       /**< Set once more than maxSize distinct keys were seen. */
+};
+
+/**
+ * @brief Initializes an empty palette.
+ *
+ * @param pal Pointer to the palette structure to initialize.
+ * @param keySize Bit length of a key.
+ */
+void initPalette(struct palette *pal, unsigned int keySize);
+
+/**
+ * @brief Adds a key to the palette, unless it is already there.
+ *
+ * Once the palette is full further keys are ignored, a chunk with that many
+ * distinct keys does not get a palette.
+ *
+ * @param pal Pointer to the palette structure.
+ * @param key Key to add, left-aligned as findRuns() gives them.
+ */
+void addToPalette(struct palette *pal, uint64_t key);
+
+/**
+ * @brief Rewrites a key stream as palette indices.
+ *
+ * The stream written holds every key of the palette at keySize bits, then
+ * the index of every key of the stream at the fewest bits telling them all
+ * apart, at least one.
+ *
+ * @param pal Palette holding every key of the stream.
+ * @param in Bytes of the key stream.
+ * @param size Size of the key stream in bytes.
+ * @param numKeys Number of keys in the key stream.
+ * @param out Receives the rewritten stream, to be freed by the caller.
+ * @param outSize Receives the size of the rewritten stream.
+ * @return 0 if the rewritten stream is smaller than the key stream, -1 otherwise or on error.
+ */
+int paletteEncode(const struct palette *pal, unsigned char *in, size_t size,
+		  uint64_t numKeys, unsigned char **out, size_t *outSize);
+
+#endif // PALETTE_H
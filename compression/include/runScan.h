@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: GPL-3.0 */
+
+/*
+ * Run detection over the keys of a buffer.
+ *
+ * findRuns() picks a kernel from the key size: 1-bit keys are measured
+ * with clz on whole words, keys of 1, 2, 4 or 8 bytes are compared in place
+ * with vector instructions and any other size is compared bit-parallel
+ * against the stream shifted by one key. Every kernel gives the same runs.
+ */
+
+#ifndef RUN_SCAN_H
+#define RUN_SCAN_H
+
+#include <inttypes.h>
+
+/**
+ * @brief Run left open between two findRuns() calls.
+ */
+struct runScan {
+	uint64_t last;          /**< Key of the open run, left-aligned. */
+	uint64_t count;         /**< Length of the open run, 0 before the first key. */
+};
+
+/**
+ * @brief Initializes a runScan structure, with no run open.
+ *
+ * @param scan Pointer to the runScan structure to initialize.
+ */
+void initRunScan(struct runScan *scan);
+
+/**
+ * @brief Finds the runs of equal keys in a stretch of a buffer.
+ *
+ * Every run closed inside the stretch is appended to runKeys and runCounts.
+ * The run still open at the end of the stretch is kept in scan, so a long
+ * stretch can be scanned in several calls.
+ *
+ * @param scan Run state carried from one call to the next.
+ * @param buffer Buffer holding the keys.
+ * @param size Size of the buffer in bytes, a last key cut by it is padded with zeros.
+ * @param startBit Bit offset of the first key to scan.
+ * @param numKeys Number of keys to scan.
+ * @param keySize Bit length of a key.
+ * @param runKeys Array of at least numKeys entries receiving the key of each run, left-aligned.
+ * @param runCounts Array of at least numKeys entries receiving the length of each run.
+ * @return Number of runs closed.
+ */
+unsigned long findRuns(struct runScan *scan, unsigned char *buffer,
+		       unsigned long size, unsigned long startBit,
+		       unsigned long numKeys, unsigned int keySize,
+		       uint64_t *runKeys, uint64_t *runCounts);
+
+#endif // RUN_SCAN_H
@@ -4,53 +4,90 @@
 #define WRITE_BUFF
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdio.h>
 
+// Default size of the block a writeBuff packs keys into, a file sink writes
+// it out with a single fwrite() once full
+#ifndef WRITE_BUFF_BLOCK
+#define WRITE_BUFF_BLOCK (4UL << 20)
+#endif
+
 /**
  * @brief Structure for buffering and writing 64-bit data to a file based on a key size.
  *
  * This structure manages a buffer and writes data to a file, handling bit-level
- * operations based on the specified key size. It efficiently stores and writes
- * data, ensuring that only the relevant bits are written to the file.
+ * operations based on the specified key size. Full 64-bit words are stored
+ * big-endian into a large block, which is either written to the file in one
+ * call once full or, for an in-memory sink, grown to hold the whole stream.
  */
 struct writeBuff {
-	FILE *file;             /**< Pointer to the file for writing. */
+	FILE *file;             /**< Pointer to the file for writing, NULL for an in-memory sink. */
 	unsigned int keySize;   /**< Number of bits to write for each element (key size). */
 	unsigned int currBit;   /**< Current bit position within the buffer. */
 	uint64_t buff;		/**< Buffer to hold data before writing to file. */
+	unsigned char *block;   /**< Packed bytes not written out yet. */
+	size_t blockSize;       /**< Allocated size of block. */
+	size_t blockUsed;       /**< Number of bytes used in block. */
+	int err;                /**< Set once a write or an allocation failed. */
 };
 
 /**
  * @brief Initializes a writeBuff structure.
  *
  * Sets up the write buffer with the given file and key size, initializing the
- * current bit position and buffer.
+ * current bit position and buffer. With a NULL file the stream is kept in
+ * memory: after closeWriteBuff() it is found in block, blockUsed bytes long,
+ * and the caller frees block.
  *
  * @param wBuff Pointer to the writeBuff structure to initialize.
- * @param file Pointer to the file to write to.
+ * @param file Pointer to the file to write to, or NULL for an in-memory sink.
  * @param keySize Number of bits to write for each element (key size).
+ * @param blockSize Bytes written per fwrite(), or starting size of an in-memory sink, 0 for WRITE_BUFF_BLOCK.
+ * @return 0 on success, -1 if the block could not be allocated.
  */
-void initWriteBuff(struct writeBuff *wBuff, FILE *file, unsigned int keySize);
+int initWriteBuff(struct writeBuff *wBuff, FILE *file, unsigned int keySize,
+		  size_t blockSize);
 
 /**
  * @brief Pushes a 64-bit value to the write buffer.
  *
  * Writes the specified number of bits (key size) from the given value to the
- * buffer. When the buffer is full, it writes the buffered data to the file.
+ * buffer. When the block is full, it writes the buffered data to the file.
  *
  * @param wBuff Pointer to the writeBuff structure.
  * @param toWrite The 64-bit value to write to the buffer.
  */
 void pushToWriteBuff(struct writeBuff *wBuff, uint64_t toWrite);
 
+/**
+ * @brief Pushes a value of any width to the write buffer.
+ *
+ * Like pushToWriteBuff(), for streams mixing values of different widths.
+ *
+ * @param wBuff Pointer to the writeBuff structure.
+ * @param toWrite The value to write, right-aligned.
+ * @param numBits Number of bits to write, 0 <= numBits <= 64.
+ */
+void pushBitsToWriteBuff(struct writeBuff *wBuff, uint64_t toWrite,
+			 unsigned int numBits);
+
+/**
+ * @brief Pads the write buffer with zeros up to the next byte boundary.
+ *
+ * @param wBuff Pointer to the writeBuff structure.
+ */
+void alignWriteBuff(struct writeBuff *wBuff);
+
 /**
  * @brief Closes the write buffer and flushes any remaining data to the file.
  *
- * Ensures that all buffered data is written to the file and that the file is
- * properly closed.
+ * Ensures that all buffered data is written to the file, padding the last
+ * byte with zeros. The file itself is left open.
  *
  * @param wBuff Pointer to the writeBuff structure.
+ * @return 0 on success, -1 if any write or allocation failed.
  */
-void closeWriteBuff(struct writeBuff *wBuff);
+int closeWriteBuff(struct writeBuff *wBuff);
 
 #endif // WRITE_BUFF
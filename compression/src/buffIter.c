@@ -3,10 +3,56 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "../include/buffIter.h"
 #include "../include/common.h"
 
+// Loads 8 bytes as a big-endian word with a single unaligned load
+static inline uint64_t load64(const unsigned char *ptr)
+{
+	uint64_t word;
+
+	memcpy(&word, ptr, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+// Tops bitBuf up to at least 56 valid bits. Close to the end of the buffer
+// the load is done byte by byte, with zeros past the end.
+static inline void refill(struct buffIter *iter)
+{
+	uint64_t word;
+
+	if (iter->nextByte + 8 <= iter->buffSize) {
+		word = load64(iter->buff + iter->nextByte);
+	} else {
+		unsigned char tail[8] = { 0 };
+
+		if (iter->nextByte < iter->buffSize)
+			memcpy(tail, iter->buff + iter->nextByte,
+			       iter->buffSize - iter->nextByte);
+		word = load64(tail);
+	}
+
+	iter->bitBuf |= word >> iter->bitCount;
+	iter->nextByte += (63 - iter->bitCount) >> 3;
+	iter->bitCount |= 56;
+}
+
+// Takes the next n bits, 1 <= n <= 56, left-aligned. bitBuf must hold at
+// least n bits.
+static inline uint64_t take(struct buffIter *iter, unsigned int n)
+{
+	uint64_t ret = iter->bitBuf & ~(~0ULL >> n);
+
+	iter->bitBuf <<= n;
+	iter->bitCount -= n;
+	return ret;
+}
+
 // Used to setup a buffer iterator
 // Range of bitStepSize = [1,64]
 void initBuffIter(struct buffIter *iter, unsigned char *buffer,
@@ -15,12 +61,19 @@ void initBuffIter(struct buffIter *iter, unsigned char *buffer,
 	iter->buff = buffer;
 	iter->buffSize = bufferSize;
 	iter->stepSize = bitStepSize;
-	iter->currBit = 0;
+	setStartOffset(iter, 0);
 }
 
 void setStartOffset(struct buffIter *iter, unsigned long startBitOffset)
 {
 	iter->currBit = startBitOffset;
+	iter->nextByte = startBitOffset / 8;
+	iter->bitBuf = 0;
+	iter->bitCount = 0;
+
+	refill(iter);
+	if (startBitOffset % 8)
+		take(iter, startBitOffset % 8);
 }
 
 bool iterHasNext(struct buffIter *iter)
@@ -32,38 +85,54 @@ bool iterHasNext(struct buffIter *iter)
 
 void advance(struct buffIter *iter, uint64_t *result)
 {
-	// If we can advance in the bits, then do so. I think I fixed this...
-	if ((iter->currBit + (iter->stepSize)) <=
-	    (iter->buffSize) * 8 + (iter->stepSize)) {
-		// Current bit and next bit are guaranteed to be in the same
-		// uint64_t because the keySize is guaranteed to be <= 64
-
-		unsigned char *ptr = &(iter->buff[iter->currBit / 8]);
-		uint64_t container = 0;
-
-		// Now, for the next 8 bytes, copy them into container
-		container = (((uint64_t)(ptr[0])) << (56));
-		container += (((uint64_t)(ptr[1])) << (48));
-		container += (((uint64_t)(ptr[2])) << (40));
-		container += (((uint64_t)(ptr[3])) << (32));
-		container += (((uint64_t)(ptr[4])) << (24));
-		container += (((uint64_t)(ptr[5])) << (16));
-		container += (((uint64_t)(ptr[6])) << (8));
-		container += (((uint64_t)(ptr[7])) << (0));
+	advanceBatch(iter, result, 1);
+}
 
-		unsigned int nextBitInCntnr =
-			(iter->currBit % 8) + (iter->stepSize);
+unsigned long advanceBatch(struct buffIter *iter, uint64_t *keys,
+			   unsigned long n)
+{
+	unsigned int k = iter->stepSize;
+	unsigned long totalBits = iter->buffSize * 8;
+	unsigned long i = 0;
 
-		// Shift to the right
-		container = (container >> (64 - nextBitInCntnr));
+	// Keys left, counting a last one cut by the end of the buffer
+	if (iter->currBit >= totalBits)
+		return 0;
+	if (n > (totalBits - iter->currBit + k - 1) / k)
+		n = (totalBits - iter->currBit + k - 1) / k;
 
-		// Then shift back to the left
-		container = (container << (64 - iter->stepSize));
+	if (k <= 28) {
+		// Every refill is good for at least two keys
+		unsigned int perRefill = 56 / k;
 
-		*result = container;
+		for (; i + perRefill <= n; i += perRefill) {
+			refill(iter);
+			for (unsigned int j = 0; j < perRefill; ++j)
+				keys[i + j] = take(iter, k);
+		}
 
-		iter->currBit += iter->stepSize;
+		if (i < n) {
+			refill(iter);
+			for (; i < n; ++i)
+				keys[i] = take(iter, k);
+		}
+	} else if (k <= 56) {
+		for (; i < n; ++i) {
+			refill(iter);
+			keys[i] = take(iter, k);
+		}
+	} else {
+		// Too wide for one refill, take it in two halves
+		for (; i < n; ++i) {
+			refill(iter);
+			keys[i] = take(iter, 32);
+			refill(iter);
+			keys[i] |= take(iter, k - 32) >> 32;
+		}
 	}
+
+	iter->currBit += n * k;
+	return n;
 }
 
 unsigned long unusedBuffBits(struct buffIter *iter)
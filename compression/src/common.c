@@ -5,15 +5,6 @@
 
 #include "../include/common.h"
 
-void write64ToFile(FILE *file, uint64_t toWrite)
-{
-	for (int i = 1; i <= 8; ++i) {
-		unsigned char chunk = (toWrite >> (64 - i * 8)) & 0xFF;
-
-		fputc(chunk, file);
-	}
-}
-
 void subtractTime(struct timeval *start, struct timeval *end,
 		  struct timeval *elapsed)
 {
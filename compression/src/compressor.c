@@ -1,32 +1,472 @@
 // SPDX-License-Identifier: GPL-3.0
 
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include "../include/buffIter.h"
+#include "../include/common.h"
 #include "../include/compressor.h"
+#include "../include/huffman.h"
+#include "../include/palette.h"
+#include "../include/runScan.h"
+#include "../include/writeBuff.h"
 
-void initMetaFile(FILE *metaFile, unsigned int lengthOfRunInBits,
-		  unsigned long numRuns, unsigned int numDprocs)
+// Number of keys handed to findRuns() per call
+#define RUN_BATCH 4096
+
+// Key sizes tried by pickKeySize(), largest first
+static const unsigned int keySizeCandidates[] = { 64, 32, 16, 8 };
+
+// pickKeySize() compresses this many windows of KEY_SAMPLE_BYTES bytes
+// spread over a piece
+#define KEY_SAMPLE_WINDOWS 4
+#define KEY_SAMPLE_BYTES (64UL << 10)
+
+// Single keys in a row written as one escaped series. A run costs one count
+// and a series two, the escape and its length, while both store every key
+// once, so three single keys are already cheaper as a series.
+#define LITERAL_MIN_RUNS 3
+
+// Smallest number of keys making up a whole number of bytes, that is
+// 8 / gcd(keySize, 8)
+static uint64_t keysPerByteBoundary(unsigned int keySize)
+{
+	// The lowest set bit is the largest power of two dividing keySize
+	unsigned int lowBit = keySize & -keySize;
+
+	return 8 / (lowBit > 8 ? 8 : lowBit);
+}
+
+unsigned long chunkBytes(unsigned int keySize)
+{
+	// Any candidate key size divides the pieces of the largest one
+	if (keySize == ADAPTIVE_KEY_SIZE)
+		keySize = keySizeCandidates[0];
+
+	// Bytes taken by the smallest run of keys ending on a byte boundary
+	unsigned long unit = keysPerByteBoundary(keySize) * keySize / 8;
+
+	if (DEFAULT_CHUNK_SIZE < unit)
+		return unit;
+
+	return DEFAULT_CHUNK_SIZE - DEFAULT_CHUNK_SIZE % unit;
+}
+
+void getChunkEdge(unsigned char *buffer, unsigned long size,
+		  unsigned int keySize, const struct chunkEdge *prev,
+		  struct chunkEdge *edge)
+{
+	struct buffIter iter;
+	struct runScan scan;
+	uint64_t runKeys[RUN_BATCH];
+	uint64_t runCounts[RUN_BATCH];
+
+	// Keys in the piece, only whole ones can join the previous chunk
+	unsigned long numKeys = (size * 8 + keySize - 1) / keySize;
+	unsigned long wholeKeys = (size * 8) / keySize;
+
+	edge->firstKey = edge->lastKey = 0;
+	edge->leadRun = 0;
+	edge->keySize = keySize;
+
+	if (numKeys == 0)
+		return;
+
+	initBuffIter(&iter, buffer, size, keySize);
+	advance(&iter, &edge->firstKey);
+	setStartOffset(&iter, (numKeys - 1) * keySize);
+	advance(&iter, &edge->lastKey);
+
+	// The leading run is only worth measuring if it can join the piece
+	// before, then it is found by the same kernels as any other run
+	if (prev && (prev->keySize != keySize ||
+		     prev->lastKey != edge->firstKey))
+		return;
+
+	initRunScan(&scan);
+
+	for (unsigned long done = 0; done < wholeKeys; done += RUN_BATCH) {
+		unsigned long batch = wholeKeys - done < RUN_BATCH ?
+					      wholeKeys - done :
+					      RUN_BATCH;
+
+		if (findRuns(&scan, buffer, size, done * keySize, batch,
+			     keySize, runKeys, runCounts) > 0) {
+			edge->leadRun = runCounts[0];
+			break;
+		}
+	}
+
+	// No run closed, the whole piece is a single run
+	if (edge->leadRun == 0)
+		edge->leadRun = scan.count;
+
+	edge->leadRun -= edge->leadRun % keysPerByteBoundary(keySize);
+}
+
+uint64_t stitchedKeys(struct chunkEdge *prev, struct chunkEdge *edge)
+{
+	if (prev->keySize != edge->keySize)
+		return 0;
+
+	return prev->lastKey == edge->firstKey ? edge->leadRun : 0;
+}
+
+unsigned int pickKeySize(unsigned char *buffer, unsigned long size)
+{
+	unsigned long window = KEY_SAMPLE_BYTES, numWindows = KEY_SAMPLE_WINDOWS;
+	unsigned int best = keySizeCandidates[0];
+	uint64_t bestSize = UINT64_MAX;
+	struct chunk chunk;
+
+	// Small pieces are tried whole
+	if (size <= window * numWindows) {
+		window = size;
+		numWindows = 1;
+	}
+
+	for (unsigned int c = 0; c < sizeof(keySizeCandidates) /
+					 sizeof(*keySizeCandidates);
+	     ++c) {
+		uint64_t total = 0;
+
+		for (unsigned long w = 0; w < numWindows; ++w) {
+			unsigned long offset = 0;
+
+			// Windows start on a whole number of the largest keys
+			if (numWindows > 1)
+				offset = (size - window) * w / (numWindows - 1) &
+					 ~7UL;
+
+			if (compressChunk(buffer + offset, window,
+					  keySizeCandidates[c], 0, 0, 0,
+					  &chunk)) {
+				total = UINT64_MAX;
+				break;
+			}
+
+			total += chunk.size;
+			free(chunk.bytes);
+		}
+
+		if (total < bestSize) {
+			bestSize = total;
+			best = keySizeCandidates[c];
+		}
+	}
+
+	return best;
+}
+
+// Number of bits needed to write value, 0 for 0
+static unsigned int bitWidth(uint64_t value)
+{
+	return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+/*
+ * Layout of a block of a COUNTS_BLOCKED count stream: every value is written
+ * at width bits, values wider than that are exceptions whose high bits are
+ * patched in.
+ */
+struct countBlock {
+	unsigned int width;     /**< Bits written for every value. */
+	unsigned int excWidth;  /**< Bits written for the high part of an exception. */
+	unsigned int numExc;    /**< Number of exceptions. */
+};
+
+// Picks the width taking the fewest bits for a block of n values
+static void planCountBlock(const uint64_t *values, unsigned int n,
+			   struct countBlock *block)
 {
-	// Write first 8 bits as number of processes to use
-	// during the decompression.
-	fputc(numDprocs, metaFile);
+	unsigned int hist[65] = { 0 }, maxWidth = 0, exc = 0;
 
-	// Write first 48 bits as total number of runs
-	for (int i = 1; i <= 6; ++i) {
-		unsigned char chunk = (numRuns >> (48 - i * 8)) & 0xFF;
+	for (unsigned int i = 0; i < n; ++i) {
+		unsigned int w = bitWidth(values[i]);
 
-		fputc(chunk, metaFile);
+		++hist[w];
+		if (w > maxWidth)
+			maxWidth = w;
 	}
 
-	// Write next 8 bits as the length of a run in bits
-	fputc((int)lengthOfRunInBits, metaFile);
+	uint64_t best = (uint64_t)n * maxWidth;
+
+	block->width = maxWidth;
+	block->excWidth = 0;
+	block->numExc = 0;
+
+	// Every bit taken off the width turns the values needing it into
+	// exceptions, each costing its position and its high bits
+	for (unsigned int w = maxWidth; w-- > 0;) {
+		exc += hist[w + 1];
+
+		uint64_t cost = (uint64_t)n * w + exc * (7 + maxWidth - w);
+
+		if (cost < best) {
+			best = cost;
+			block->width = w;
+			block->excWidth = maxWidth - w;
+			block->numExc = exc;
+		}
+	}
+}
+
+// Writes a block of n values of a COUNTS_BLOCKED count stream
+static void writeCountBlock(struct writeBuff *wBuff, const uint64_t *values,
+			    unsigned int n, const struct countBlock *block)
+{
+	uint64_t mask = block->width ? ~0ULL >> (64 - block->width) : 0;
+
+	pushBitsToWriteBuff(wBuff, block->width, 8);
+	pushBitsToWriteBuff(wBuff, block->numExc, 8);
+	pushBitsToWriteBuff(wBuff, block->excWidth, 8);
+
+	for (unsigned int i = 0; block->numExc > 0 && i < n; ++i) {
+		if (bitWidth(values[i]) > block->width) {
+			pushBitsToWriteBuff(wBuff, i, 7);
+			pushBitsToWriteBuff(wBuff, values[i] >> block->width,
+					    block->excWidth);
+		}
+	}
+
+	for (unsigned int i = 0; i < n; ++i)
+		pushBitsToWriteBuff(wBuff, values[i] & mask, block->width);
+
+	alignWriteBuff(wBuff);
 }
 
-void initDataFile(FILE *dataFile, unsigned int keySize)
+/*
+ * Count stream of a chunk being built, packed a block of COUNT_BLOCK counts
+ * at a time as the runs are found. Runs of a single key are held back until
+ * it is known whether enough of them follow one another to be written as an
+ * escaped series: a 0, then the number of keys in the series. The length of
+ * an open series keeps growing, so the escape and the length only go into
+ * the block once the series ends.
+ */
+struct countSink {
+	struct writeBuff *meta;         /**< Count stream blocks are packed into. */
+	uint64_t block[COUNT_BLOCK];    /**< Counts of the block being filled. */
+	unsigned int blockUsed;         /**< Number of counts in block. */
+	uint64_t numRecords;            /**< Runs and series written so far. */
+	unsigned int singles;           /**< Runs of a single key held back. */
+	int inSeries;                   /**< Whether a series is still open. */
+	uint64_t series;                /**< Number of keys in the open series. */
+};
+
+// Packs the counts gathered so far as the next block of the count stream
+static void flushCountBlock(struct countSink *sink)
 {
-	// Write first 8 bits as keySize
-	fputc(keySize, dataFile);
+	struct countBlock block;
+
+	if (sink->blockUsed == 0)
+		return;
+
+	planCountBlock(sink->block, sink->blockUsed, &block);
+	writeCountBlock(sink->meta, sink->block, sink->blockUsed, &block);
+	sink->blockUsed = 0;
+}
+
+// Appends a count to the block being filled
+static void putCount(struct countSink *sink, uint64_t count)
+{
+	sink->block[sink->blockUsed++] = count;
+
+	if (sink->blockUsed == COUNT_BLOCK)
+		flushCountBlock(sink);
+}
+
+// Writes out the runs held back and ends the open series, if any
+static void flushSingles(struct countSink *sink)
+{
+	if (sink->inSeries) {
+		putCount(sink, 0);
+		putCount(sink, sink->series);
+		sink->inSeries = 0;
+	}
+
+	for (; sink->singles > 0; --sink->singles) {
+		putCount(sink, 1);
+		++sink->numRecords;
+	}
+}
+
+// Adds a run of count keys to the count stream
+static void pushRun(struct countSink *sink, uint64_t count)
+{
+	if (count > 1) {
+		flushSingles(sink);
+		putCount(sink, count);
+		++sink->numRecords;
+		return;
+	}
+
+	if (sink->inSeries) {
+		++sink->series;
+		return;
+	}
+
+	if (++sink->singles < LITERAL_MIN_RUNS)
+		return;
+
+	// Enough single keys in a row, start a series with them
+	sink->series = sink->singles;
+	sink->inSeries = 1;
+	sink->singles = 0;
+	++sink->numRecords;
+}
+
+int compressChunk(unsigned char *buffer, unsigned long size,
+		  unsigned int keySize, uint64_t skipKeys, uint64_t extraKeys,
+		  int useEntropy, struct chunk *out)
+{
+	struct buffIter iter;
+	struct runScan scan;
+	struct writeBuff dataWriter;
+	struct writeBuff metaWriter;
+	struct countSink sink = { .meta = &metaWriter };
+	struct palette *pal = NULL;
+	uint64_t dataKeys = 0;
+	int err = 0;
+
+	uint64_t runKeys[RUN_BATCH];
+	uint64_t runCounts[RUN_BATCH];
+
+	// Number of keys in the piece, the last one may be padded with zeros
+	unsigned long numKeys = (size * 8 + keySize - 1) / keySize;
+	unsigned long toScan = 0;
+
+	// Both streams are built in memory, the caller decides where the
+	// chunk ends up in the archive
+	err |= initWriteBuff(&dataWriter, NULL, keySize, 0);
+	err |= initWriteBuff(&metaWriter, NULL, 0, 0);
+
+	if (err) {
+		free(dataWriter.block);
+		free(metaWriter.block);
+		return -1;
+	}
+
+	initRunScan(&scan);
+
+	// Distinct keys are tracked for a palette, single bit keys cannot be
+	// written any shorter
+	if (keySize > 1 && (pal = malloc(sizeof(*pal))))
+		initPalette(pal, keySize);
+
+	if (skipKeys < numKeys) {
+		toScan = numKeys - skipKeys;
+	} else if (numKeys > 0) {
+		// The whole piece joined the previous chunk, only the run
+		// stitched from the next piece, if any, is left
+		initBuffIter(&iter, buffer, size, keySize);
+		setStartOffset(&iter, (numKeys - 1) * keySize);
+		advance(&iter, &scan.last);
+	}
+
+	// Go through the buffer, RUN_BATCH keys at a time, writing every run
+	// found to our streams. Keys go to the key stream the same way whether
+	// their runs end up in a series or not.
+	for (unsigned long done = 0; done < toScan; done += RUN_BATCH) {
+		unsigned long batch = toScan - done < RUN_BATCH ?
+					      toScan - done :
+					      RUN_BATCH;
+		unsigned long found = findRuns(&scan, buffer, size,
+					       (skipKeys + done) * keySize,
+					       batch, keySize, runKeys,
+					       runCounts);
+
+		for (unsigned long r = 0; r < found; ++r) {
+			pushRun(&sink, runCounts[r]);
+			pushToWriteBuff(&dataWriter, runKeys[r]);
+			if (pal)
+				addToPalette(pal, runKeys[r]);
+		}
+		dataKeys += found;
+	}
+
+	// The last run is never followed by a different key, so write it here
+	// together with the keys stitched from the next piece
+	if (skipKeys < numKeys || extraKeys > 0) {
+		pushRun(&sink, scan.count + extraKeys);
+		pushToWriteBuff(&dataWriter, scan.last);
+		if (pal)
+			addToPalette(pal, scan.last);
+		++dataKeys;
+	}
+
+	flushSingles(&sink);
+	flushCountBlock(&sink);
+
+	err |= closeWriteBuff(&dataWriter);
+	err |= closeWriteBuff(&metaWriter);
+
+	size_t metaSize = metaWriter.blockUsed;
+	size_t dataSize = dataWriter.blockUsed;
+	unsigned int entropy = 0, paletteSize = 0;
+	unsigned char *coded;
+	size_t codedSize;
+
+	// Few distinct keys are written once, the key stream then only
+	// gives their indices
+	if (pal && !err &&
+	    !paletteEncode(pal, dataWriter.block, dataSize, dataKeys, &coded,
+			   &codedSize)) {
+		free(dataWriter.block);
+		dataWriter.block = coded;
+		dataSize = codedSize;
+		paletteSize = pal->size;
+	}
+
+	free(pal);
+
+	// Swap in the Huffman coded streams that came out smaller
+	if (useEntropy && !err) {
+		if (!huffmanEncode(metaWriter.block, metaSize, &coded,
+				   &codedSize)) {
+			free(metaWriter.block);
+			metaWriter.block = coded;
+			metaSize = codedSize;
+			entropy |= ENTROPY_META;
+		}
+
+		if (!huffmanEncode(dataWriter.block, dataSize, &coded,
+				   &codedSize)) {
+			free(dataWriter.block);
+			dataWriter.block = coded;
+			dataSize = codedSize;
+			entropy |= ENTROPY_DATA;
+		}
+	}
+
+	// Glue the chunk header and both streams together
+	out->size = CHUNK_HEADER_SIZE + metaSize + dataSize;
+	out->bytes = err ? NULL : malloc(out->size);
+
+	if (out->bytes) {
+		makeChunkHeader(out->bytes, keySize, 0, COUNTS_BLOCKED,
+				entropy, paletteSize, sink.numRecords,
+				metaSize, dataSize);
+		memcpy(out->bytes + CHUNK_HEADER_SIZE, metaWriter.block,
+		       metaSize);
+		memcpy(out->bytes + CHUNK_HEADER_SIZE + metaSize,
+		       dataWriter.block, dataSize);
+	}
+
+	out->info.offset = 0;
+	out->info.numRuns = sink.numRecords;
+	out->info.rawSize = size - skipKeys * keySize / 8 +
+			    extraKeys * keySize / 8;
+
+	free(dataWriter.block);
+	free(metaWriter.block);
+
+	return out->bytes ? 0 : -1;
 }
 
 unsigned long getFileSize(char *filename)
@@ -40,3 +480,52 @@ unsigned long getFileSize(char *filename)
 
 	return buff.st_size;
 }
+
+int readFileRange(char *filename, unsigned long offset, unsigned long size,
+		  unsigned char *buffer)
+{
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	// pread() may return less than asked, so keep going until done
+	while (size > 0) {
+		ssize_t got = pread(fd, buffer, size, offset);
+
+		if (got < 0 && errno == EINTR)
+			continue;
+
+		if (got <= 0) {
+			if (got < 0)
+				perror("pread");
+			close(fd);
+			return -1;
+		}
+
+		buffer += got;
+		offset += got;
+		size -= got;
+	}
+
+	close(fd);
+	return 0;
+}
+
+char *archiveName(const char *inputName)
+{
+	// Only look for the extension after the last directory separator
+	const char *base = strrchr(inputName, '/');
+	const char *dot = strchr(base ? base + 1 : inputName, '.');
+	size_t cutoff = dot ? (size_t)(dot - inputName) : strlen(inputName);
+	char *name = malloc(cutoff + 5);
+
+	if (!name)
+		return NULL;
+
+	memcpy(name, inputName, cutoff);
+	strcpy(name + cutoff, ".rle");
+	return name;
+}
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-3.0
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/container.h"
+
+// Stores toPut big-endian in the 8 bytes at out
+static void put64(unsigned char *out, uint64_t toPut)
+{
+	for (int i = 1; i <= 8; ++i)
+		out[i - 1] = (toPut >> (64 - i * 8)) & 0xFF;
+}
+
+void makeContainerHeader(unsigned char *out, unsigned int keySize)
+{
+	memcpy(out, CONTAINER_MAGIC, 4);
+	out[4] = CONTAINER_VERSION;
+	out[5] = keySize;
+	out[6] = 0;
+	out[7] = 0;
+}
+
+void makeChunkHeader(unsigned char *out, unsigned int keySize,
+		     unsigned int runLen, unsigned int countCoding,
+		     unsigned int entropy, unsigned int paletteSize,
+		     uint64_t numRuns, uint64_t metaBytes, uint64_t dataBytes)
+{
+	memset(out, 0, 8);
+	out[0] = keySize;
+	out[1] = runLen;
+	out[2] = countCoding;
+	out[3] = entropy;
+	out[4] = paletteSize >> 8;
+	out[5] = paletteSize & 0xFF;
+
+	put64(out + 8, numRuns);
+	put64(out + 16, metaBytes);
+	put64(out + 24, dataBytes);
+}
+
+void makeIndex(unsigned char *out, struct chunkInfo *index,
+	       uint64_t numChunks, uint64_t indexOffset)
+{
+	for (uint64_t i = 0; i < numChunks; ++i) {
+		put64(out, index[i].offset);
+		put64(out + 8, index[i].numRuns);
+		put64(out + 16, index[i].rawSize);
+		out += INDEX_ENTRY_SIZE;
+	}
+
+	put64(out, indexOffset);
+	put64(out + 8, numChunks);
+	memcpy(out + 16, TRAILER_MAGIC, 8);
+}
+
+int writeIndex(FILE *file, struct chunkInfo *index, uint64_t numChunks,
+	       uint64_t indexOffset)
+{
+	size_t size = numChunks * INDEX_ENTRY_SIZE + TRAILER_SIZE;
+	unsigned char *buff = malloc(size);
+
+	if (!buff)
+		return -1;
+
+	makeIndex(buff, index, numChunks, indexOffset);
+
+	size_t written = fwrite(buff, 1, size, file);
+
+	free(buff);
+	return written == size ? 0 : -1;
+}
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-3.0
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/container.h"
+#include "../include/huffman.h"
+#include "../include/writeBuff.h"
+
+// Gives every byte value a code length, 0 for the values never seen. The
+// counts are halved until the longest code fits in HUFFMAN_MAX_BITS.
+static void buildLengths(const uint64_t counts[256], unsigned char len[256])
+{
+	uint64_t freq[256], weight[511];
+	int parent[511], used[511];
+
+	memcpy(freq, counts, sizeof(freq));
+
+	for (;;) {
+		int numNodes = 0, numLive, maxLen = 0;
+
+		memset(len, 0, 256);
+
+		// Leaves first, the merged nodes after them
+		for (int s = 0; s < 256; ++s) {
+			weight[s] = freq[s];
+			used[s] = freq[s] == 0;
+			parent[s] = -1;
+		}
+		numNodes = 256;
+
+		numLive = 0;
+		for (int s = 0; s < 256; ++s)
+			numLive += !used[s];
+
+		// A single value still needs a one-bit code
+		if (numLive == 1) {
+			for (int s = 0; s < 256; ++s)
+				if (!used[s])
+					len[s] = 1;
+			return;
+		}
+
+		// Keep merging the two lightest nodes left
+		while (numLive > 1) {
+			int a = -1, b = -1;
+
+			for (int n = 0; n < numNodes; ++n) {
+				if (used[n])
+					continue;
+				if (a < 0 || weight[n] < weight[a]) {
+					b = a;
+					a = n;
+				} else if (b < 0 || weight[n] < weight[b]) {
+					b = n;
+				}
+			}
+
+			weight[numNodes] = weight[a] + weight[b];
+			used[numNodes] = 0;
+			parent[numNodes] = -1;
+			used[a] = used[b] = 1;
+			parent[a] = parent[b] = numNodes;
+			++numNodes;
+			--numLive;
+		}
+
+		for (int s = 0; s < 256; ++s) {
+			int depth = 0;
+
+			if (freq[s] == 0)
+				continue;
+			for (int n = s; parent[n] >= 0; n = parent[n])
+				++depth;
+			len[s] = depth;
+			if (depth > maxLen)
+				maxLen = depth;
+		}
+
+		if (maxLen <= HUFFMAN_MAX_BITS)
+			return;
+
+		for (int s = 0; s < 256; ++s)
+			if (freq[s])
+				freq[s] = (freq[s] + 1) / 2;
+	}
+}
+
+int huffmanEncode(const unsigned char *in, size_t size, unsigned char **out,
+		  size_t *outSize)
+{
+	uint64_t counts[256] = { 0 }, codes[256], bits = 0;
+	unsigned char len[256];
+	struct writeBuff w;
+
+	*out = NULL;
+	if (size == 0)
+		return -1;
+
+	for (size_t i = 0; i < size; ++i)
+		++counts[in[i]];
+
+	buildLengths(counts, len);
+
+	for (int s = 0; s < 256; ++s)
+		bits += counts[s] * len[s];
+
+	// Not worth it if the table and codes do not beat the plain stream
+	if (HUFFMAN_HEADER_SIZE + (bits + 7) / 8 >= size)
+		return -1;
+
+	// Canonical codes: shorter first, then in byte order
+	uint64_t code = 0;
+
+	for (unsigned int l = 1; l <= HUFFMAN_MAX_BITS; ++l) {
+		for (int s = 0; s < 256; ++s)
+			if (len[s] == l)
+				codes[s] = code++;
+		code <<= 1;
+	}
+
+	if (initWriteBuff(&w, NULL, 8, HUFFMAN_HEADER_SIZE + bits / 8 + 16)) {
+		free(w.block);
+		return -1;
+	}
+
+	pushBitsToWriteBuff(&w, size, 64);
+	for (int s = 0; s < 256; ++s)
+		pushBitsToWriteBuff(&w, len[s], 4);
+
+	for (size_t i = 0; i < size; ++i)
+		pushBitsToWriteBuff(&w, codes[in[i]], len[in[i]]);
+
+	if (closeWriteBuff(&w)) {
+		free(w.block);
+		return -1;
+	}
+
+	*out = w.block;
+	*outSize = w.blockUsed;
+	return 0;
+}
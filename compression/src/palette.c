@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-3.0
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "../include/buffIter.h"
+#include "../include/palette.h"
+#include "../include/writeBuff.h"
+
+// Number of keys read back from the key stream per advanceBatch() call
+#define PALETTE_BATCH 1024
+
+// Slot a key is looked up from, the high bits of a multiplicative hash
+static unsigned int hashSlot(uint64_t key)
+{
+	unsigned int slotBits = __builtin_ctz(PALETTE_SLOTS);
+
+	return (key * 0x9E3779B97F4A7C15ULL) >> (64 - slotBits);
+}
+
+// Slot holding key, or the empty slot it would go into
+static unsigned int findSlot(const struct palette *pal, uint64_t key)
+{
+	unsigned int slot = hashSlot(key);
+
+	while (pal->slots[slot] && pal->keys[pal->slots[slot] - 1] != key)
+		slot = (slot + 1) % PALETTE_SLOTS;
+
+	return slot;
+}
+
+void initPalette(struct palette *pal, unsigned int keySize)
+{
+	for (unsigned int i = 0; i < PALETTE_SLOTS; ++i)
+		pal->slots[i] = 0;
+
+	// Indices need to be at least one bit shorter than the keys
+	pal->keySize = keySize;
+	pal->maxSize = keySize <= 12 ? 1U << (keySize - 1) : PALETTE_MAX;
+	pal->size = 0;
+	pal->full = 0;
+}
+
+void addToPalette(struct palette *pal, uint64_t key)
+{
+	if (pal->full)
+		return;
+
+	key >>= 64 - pal->keySize;
+
+	unsigned int slot = findSlot(pal, key);
+
+	if (pal->slots[slot])
+		return;
+
+	if (pal->size == pal->maxSize) {
+		pal->full = 1;
+		return;
+	}
+
+	pal->keys[pal->size++] = key;
+	pal->slots[slot] = pal->size;
+}
+
+int paletteEncode(const struct palette *pal, unsigned char *in, size_t size,
+		  uint64_t numKeys, unsigned char **out, size_t *outSize)
+{
+	struct buffIter iter;
+	struct writeBuff wBuff;
+	uint64_t keys[PALETTE_BATCH];
+	unsigned int keySize = pal->keySize, indexBits = 1;
+
+	if (pal->full || pal->size == 0)
+		return -1;
+
+	while ((1U << indexBits) < pal->size)
+		++indexBits;
+
+	// Both parts of the stream, the palette then the indices
+	uint64_t bits = (uint64_t)pal->size * keySize + numKeys * indexBits;
+
+	if (indexBits >= keySize || (bits + 7) / 8 >= size)
+		return -1;
+
+	if (initWriteBuff(&wBuff, NULL, indexBits, (bits + 7) / 8 + 8)) {
+		free(wBuff.block);
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < pal->size; ++i)
+		pushBitsToWriteBuff(&wBuff, pal->keys[i], keySize);
+
+	initBuffIter(&iter, in, size, keySize);
+
+	for (uint64_t done = 0; done < numKeys;) {
+		unsigned long n = numKeys - done < PALETTE_BATCH ?
+					  numKeys - done :
+					  PALETTE_BATCH;
+
+		n = advanceBatch(&iter, keys, n);
+		if (n == 0)
+			break;
+
+		for (unsigned long i = 0; i < n; ++i) {
+			unsigned int slot = findSlot(pal,
+						     keys[i] >> (64 - keySize));
+
+			pushBitsToWriteBuff(&wBuff, pal->slots[slot] - 1,
+					    indexBits);
+		}
+		done += n;
+	}
+
+	if (closeWriteBuff(&wBuff)) {
+		free(wBuff.block);
+		return -1;
+	}
+
+	*out = wBuff.block;
+	*outSize = wBuff.blockUsed;
+	return 0;
+}
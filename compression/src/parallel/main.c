@@ -2,6 +2,7 @@
 
 #include <inttypes.h>
 #include <mpi.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,13 +13,233 @@
 #include "../../include/buffIter.h"
 #include "../../include/common.h"
 #include "../../include/compressor.h"
-#include "../../include/writeBuff.h"
+#include "../../include/container.h"
+
+// MPI-IO counts are ints, so bigger slices are read in several rounds
+#define MPI_IO_MAX_BYTES (1UL << 30)
+
+// Tag used to swap chunk edges between neighbouring ranks
+#define EDGE_TAG 1
+
+/*
+ * Reads [offset, offset + size) of the file into buffer using collective
+ * MPI-IO. Every rank of MPI_COMM_WORLD must call this. Returns 0 on success
+ * and -1 on every rank if any of them failed.
+ */
+static int readSliceMPI(char *filename, unsigned long offset,
+			unsigned long size, unsigned char *buffer)
+{
+	MPI_File fh;
+	MPI_Status status;
+	unsigned long myRounds, rounds, done = 0;
+	int err = 0, anyErr;
+
+	if (MPI_File_open(MPI_COMM_WORLD, filename, MPI_MODE_RDONLY,
+			  MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+		return -1;
+
+	// Ranks with less to read still have to join every collective call
+	myRounds = (size + MPI_IO_MAX_BYTES - 1) / MPI_IO_MAX_BYTES;
+	MPI_Allreduce(&myRounds, &rounds, 1, MPI_UNSIGNED_LONG, MPI_MAX,
+		      MPI_COMM_WORLD);
+
+	for (unsigned long r = 0; r < rounds; ++r) {
+		unsigned long left = size - done;
+		int count = (int)(left < MPI_IO_MAX_BYTES ? left :
+							    MPI_IO_MAX_BYTES);
+		int got = 0;
+
+		if (MPI_File_read_at_all(fh, (MPI_Offset)(offset + done),
+					 buffer + done, count,
+					 MPI_UNSIGNED_CHAR,
+					 &status) != MPI_SUCCESS)
+			err = 1;
+		else
+			MPI_Get_count(&status, MPI_UNSIGNED_CHAR, &got);
+
+		if (got != count)
+			err = 1;
+
+		done += count;
+	}
+
+	MPI_File_close(&fh);
+
+	MPI_Allreduce(&err, &anyErr, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+	return anyErr ? -1 : 0;
+}
+
+/*
+ * Writes buffer to [offset, offset + size) of an open file using collective
+ * MPI-IO. Every rank that opened the file must call this. Returns 0 on
+ * success and 1 if this rank failed.
+ */
+static int writeSliceMPI(MPI_File fh, uint64_t offset, unsigned char *buffer,
+			 uint64_t size)
+{
+	MPI_Status status;
+	uint64_t myRounds, rounds, done = 0;
+	int err = 0;
+
+	// Ranks with less to write still have to join every collective call
+	myRounds = (size + MPI_IO_MAX_BYTES - 1) / MPI_IO_MAX_BYTES;
+	MPI_Allreduce(&myRounds, &rounds, 1, MPI_UINT64_T, MPI_MAX,
+		      MPI_COMM_WORLD);
+
+	for (uint64_t r = 0; r < rounds; ++r) {
+		uint64_t left = size - done;
+		int count = (int)(left < MPI_IO_MAX_BYTES ? left :
+							    MPI_IO_MAX_BYTES);
+		int put = 0;
+
+		if (MPI_File_write_at_all(fh, (MPI_Offset)(offset + done),
+					  buffer + done, count,
+					  MPI_UNSIGNED_CHAR,
+					  &status) != MPI_SUCCESS)
+			err = 1;
+		else
+			MPI_Get_count(&status, MPI_UNSIGNED_CHAR, &put);
+
+		if (put != count)
+			err = 1;
+
+		done += count;
+	}
+
+	return err;
+}
+
+/*
+ * Pieces of a rank's slice handed out to a pool of threads. Every piece is
+ * compressed into its own chunk with the runs crossing into its neighbours
+ * already stitched through skipKeys, so merging the results is only a
+ * matter of putting the chunks back in order.
+ */
+struct pieceJobs {
+	unsigned char *buffer;          /**< The slice of the rank. */
+	unsigned long size;             /**< Size of the slice in bytes. */
+	unsigned long pieceSize;        /**< Size of every piece but the last. */
+	unsigned int keySize;           /**< Size of the keys in bits, or ADAPTIVE_KEY_SIZE. */
+	int useEntropy;                 /**< Whether to try the Huffman stage. */
+	uint64_t numPieces;             /**< Number of pieces in the slice. */
+	struct chunkEdge *edges;        /**< Edges of the pieces, from slot 1. */
+	uint64_t *skipKeys;             /**< Keys stitched across every piece boundary. */
+	struct chunk *chunks;           /**< Chunk of every piece. */
+	int compress;                   /**< Compress the pieces instead of finding their edges. */
+	uint64_t next;                  /**< Next piece nobody took yet. */
+	int err;                        /**< Set once a piece failed. */
+	pthread_mutex_t lock;           /**< Guards next and err. */
+};
+
+// Fills prev with the last key of the piece before piece idx, cut into
+// keys of keySize bits. Whatever key size that piece picks, its run can
+// only go on into piece idx if that key matches.
+static struct chunkEdge *lastKeyBefore(struct pieceJobs *jobs, uint64_t idx,
+				       unsigned int keySize,
+				       struct chunkEdge *prev)
+{
+	struct buffIter iter;
+
+	initBuffIter(&iter, jobs->buffer + (idx - 1) * jobs->pieceSize,
+		     jobs->pieceSize, keySize);
+	setStartOffset(&iter, jobs->pieceSize * 8 - keySize);
+	advance(&iter, &prev->lastKey);
+	prev->keySize = keySize;
+	return prev;
+}
+
+// Takes pieces off the list until none is left
+static void *pieceWorker(void *arg)
+{
+	struct pieceJobs *jobs = arg;
+	struct chunkEdge prev;
+
+	for (;;) {
+		pthread_mutex_lock(&jobs->lock);
+		uint64_t i = jobs->next++;
+		pthread_mutex_unlock(&jobs->lock);
+
+		if (i >= jobs->numPieces)
+			break;
+
+		unsigned char *piece = jobs->buffer + i * jobs->pieceSize;
+		unsigned long size = jobs->pieceSize;
+
+		if (i == jobs->numPieces - 1)
+			size = jobs->size - i * jobs->pieceSize;
+
+		// In adaptive mode the edges also record the key size picked
+		// for the piece
+		unsigned int keySize = jobs->keySize;
+
+		if (!jobs->compress) {
+			if (keySize == ADAPTIVE_KEY_SIZE)
+				keySize = pickKeySize(piece, size);
+			getChunkEdge(piece, size, keySize,
+				     i > 0 ? lastKeyBefore(jobs, i, keySize,
+							   &prev) :
+					     NULL,
+				     &jobs->edges[i + 1]);
+		} else if (compressChunk(piece, size,
+					 jobs->edges[i + 1].keySize,
+					 jobs->skipKeys[i],
+					 jobs->skipKeys[i + 1], jobs->useEntropy,
+					 &jobs->chunks[i])) {
+			jobs->chunks[i].bytes = NULL;
+			pthread_mutex_lock(&jobs->lock);
+			jobs->err = 1;
+			pthread_mutex_unlock(&jobs->lock);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Goes through all the pieces with numThreads threads, the calling one
+ * included. Returns 0 on success and -1 if a piece failed.
+ */
+static int runPieceJobs(struct pieceJobs *jobs, int numThreads)
+{
+	pthread_t *threads = malloc(sizeof(*threads) * numThreads);
+	int started = 0;
+
+	jobs->next = 0;
+	jobs->err = 0;
+
+	// If threads cannot be had, whoever is running does all the work
+	while (threads && started < numThreads - 1 &&
+	       !pthread_create(&threads[started], NULL, pieceWorker, jobs))
+		++started;
+
+	pieceWorker(jobs);
+
+	for (int t = 0; t < started; ++t)
+		pthread_join(threads[t], NULL);
+
+	free(threads);
+	return jobs->err ? -1 : 0;
+}
+
+// Rank holding piece idx when numPieces pieces are spread over numProcs ranks
+static int pieceOwner(uint64_t idx, uint64_t numPieces, int numProcs)
+{
+	int r = (int)(idx * numProcs / numPieces);
+
+	while (numPieces * (r + 1) / numProcs <= idx)
+		++r;
+	while (r > 0 && numPieces * r / numProcs > idx)
+		--r;
+
+	return r;
+}
 
 int main(int argc, char **argv)
 {
-	int MYRANK, NUMPROCS;
+	int MYRANK, NUMPROCS, threadLevel;
 
-	MPI_Init(&argc, &argv);
+	// Only the main thread of a rank makes MPI calls
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &threadLevel);
 	MPI_Comm_rank(MPI_COMM_WORLD, &MYRANK);
 	MPI_Comm_size(MPI_COMM_WORLD, &NUMPROCS);
 
@@ -28,35 +249,56 @@ int main(int argc, char **argv)
 	if (MYRANK == MASTER_RANK)
 		gettimeofday(&tvStart, 0);
 
-	// Variables used by master
-	char *inputFileName, **dataFileNames, **metaFileNames;
-	unsigned char *fileBuffer;
-	unsigned long bufferSize, inputFileSize;
-	FILE *inputFile;
-
-	// Variables used by workers
-	unsigned long recvBufferSize;
-
 	// Variables used by everyone
-	MPI_Status status;
-	char *dataFileName, *metaFileName;
-	unsigned long myBufferSize;
+	char *inputFileName, *outputFileName;
+	unsigned long inputFileSize;
+	unsigned long myOffset, myBufferSize;
 	unsigned char *myBuffer;
 	unsigned int keySize;
-	FILE *myDataFile, *myMetaFile;
-	struct u64array counts;
-	size_t cutoff;
+	int numThreads = 1, useEntropy = 0;
+
+	// Take "--threads N" and "--entropy" out of the arguments, wherever
+	// they are
+	char *endptr;
+	int numArgs = 1;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--entropy")) {
+			useEntropy = 1;
+			continue;
+		}
 
-        static const char data[5] = ".data";
-	static const char meta[5] = ".meta";
-        
-	// Used to convert integers to strings
-	char num[20];
+		if (strcmp(argv[i], "--threads")) {
+			argv[numArgs++] = argv[i];
+			continue;
+		}
+
+		long temp = i + 1 < argc ? strtol(argv[i + 1], &endptr, 10) : 0;
+
+		if (temp < 1 || temp > 1024 || *endptr != '\0') {
+			if (MYRANK == MASTER_RANK)
+				fprintf(stderr,
+					"Invalid number of threads, must be in range of [1, 1024]\n");
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		numThreads = (int)temp;
+		++i;
+	}
+	argc = numArgs;
+
+	// Worker threads are only safe if MPI gave the thread level asked for
+	if (numThreads > 1 && threadLevel < MPI_THREAD_FUNNELED) {
+		if (MYRANK == MASTER_RANK)
+			fprintf(stderr,
+				"WARNING: MPI has no thread support, using one thread per process\n");
+		numThreads = 1;
+	}
 
 	// Master checks if all arguments are there
 	if (MYRANK == MASTER_RANK) {
-		if (argc != 3) {
-			printf("Usage: %s <input file> <key size>\n", argv[0]);
+		if (argc != 3 && argc != 4) {
+			printf("Usage: %s <input file> <key size|auto> [archive] [--threads N] [--entropy]\n",
+			       argv[0]);
 			MPI_Abort(MPI_COMM_WORLD, 1);
 		}
 	}
@@ -64,15 +306,13 @@ int main(int argc, char **argv)
 	// Do some input argument setup, assuming their validity
 	inputFileName = argv[1];
 
-	// Get the number of chars to take before the first '.' of the given
-	// inputFileName
-	cutoff = (strchr(inputFileName, '.')) - &(inputFileName[0]);
-
-	// Get the key size
-	char *endptr;
+	// Get the key size, "auto" lets every chunk pick its own
 	long temp = strtol(argv[2], &endptr, 10);
 
-	if (*endptr != '\0' || argv[2][0] == '\0' || temp < 1 || temp > 64) {
+	if (!strcmp(argv[2], "auto")) {
+		temp = ADAPTIVE_KEY_SIZE;
+	} else if (*endptr != '\0' || argv[2][0] == '\0' || temp < 1 ||
+		   temp > 64) {
 		fprintf(stderr, "Invalid key size format\n");
 		MPI_Abort(MPI_COMM_WORLD, -1);
 	}
@@ -80,7 +320,7 @@ int main(int argc, char **argv)
 
 	// Master does some validation tests
 	if (MYRANK == MASTER_RANK) {
-		if (keySize < 1 || keySize > 64) {
+		if (keySize > 64) {
 			fprintf(stderr,
 				"Invalid key size \"%d\"; must be in range of [1, 64]\n",
 				keySize);
@@ -94,218 +334,293 @@ int main(int argc, char **argv)
 		}
 
 		// Print some updates for the user
-		printf("Reading with keySize of %d bits\n", keySize);
+		if (keySize == ADAPTIVE_KEY_SIZE)
+			printf("Reading with keySize picked for every chunk\n");
+		else
+			printf("Reading with keySize of %d bits\n", keySize);
 		printf("Number of processes = %d\n", NUMPROCS);
+		printf("Threads per process = %d\n", numThreads);
+	}
 
-		// Open the input file and check if it exists
-		inputFile = fopen(inputFileName, "rb");
+	// Everybody writes to the same archive, named after the input file
+	// unless given
+	outputFileName = argc == 4 ? strdup(argv[3]) :
+				     archiveName(inputFileName);
+	if (!outputFileName)
+		MPI_Abort(MPI_COMM_WORLD, MPI_ERR_NO_MEM);
 
-		if (!inputFile) {
-			fprintf(stderr, "Error opening input file \"%s\"\n",
-				inputFileName);
-			MPI_Abort(MPI_COMM_WORLD, -1);
-		}
-	}
+	if (MYRANK == MASTER_RANK)
+		printf("Producing archive named: %s\n", outputFileName);
 
 	MPI_Barrier(MPI_COMM_WORLD);
 
-	// Get the number for our filename
-	sprintf(num, "%u", MYRANK);
+	// Master gets the size of the input file and shares it, so every rank
+	// can work out its own byte range of the input
+	if (MYRANK == MASTER_RANK) {
+		inputFileSize = getFileSize(inputFileName);
+		printf("Input file size: %lu\n", inputFileSize);
+	}
 
-	// Calculate my .data file and my .meta file names
-	dataFileName =
-		(char *)malloc(sizeof(char) * (cutoff + 6 + strlen(num)));
-	metaFileName =
-		(char *)malloc(sizeof(char) * (cutoff + 6 + strlen(num)));
+	MPI_Bcast(&inputFileSize, 1, MPI_UNSIGNED_LONG, MASTER_RANK,
+		  MPI_COMM_WORLD);
+
+	// The input is cut into pieces of pieceSize bytes, a whole number of
+	// keys each, and every piece is compressed into one chunk. Every rank
+	// takes a contiguous range of pieces, so the archive comes out the
+	// same whatever the number of ranks.
+	unsigned long pieceSize = chunkBytes(keySize);
+	uint64_t numPieces = (inputFileSize + pieceSize - 1) / pieceSize;
+	uint64_t myFirst = numPieces * MYRANK / NUMPROCS;
+	uint64_t myLast = numPieces * (MYRANK + 1) / NUMPROCS;
+	uint64_t myNumPieces = myLast - myFirst;
+
+	myOffset = myFirst * pieceSize;
+	myBufferSize = 0;
+	if (myNumPieces > 0)
+		myBufferSize = (myLast == numPieces ? inputFileSize :
+						      myLast * pieceSize) -
+			       myOffset;
 
-	dataFileName[cutoff + 5 + strlen(num)] = '\0';
-	metaFileName[cutoff + 5 + strlen(num)] = '\0';
+	if (MYRANK == MASTER_RANK)
+		printf("Number of chunks = %" PRIu64 "\n", numPieces);
+
+	// Everybody sets up their own buffer, ranks left without a slice
+	// still get a valid pointer
+	myBuffer = malloc(sizeof(unsigned char) *
+			  (myBufferSize ? myBufferSize : 1));
+	if (!myBuffer) {
+		fprintf(stderr, "Error allocating buffer for rank %d\n",
+			MYRANK);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
 
-	memmove(dataFileName, inputFileName, cutoff);
-	memmove(metaFileName, inputFileName, cutoff);
+	// Every rank reads its own slice of the input, through collective
+	// MPI-IO if possible and through plain pread() otherwise
+	if (readSliceMPI(inputFileName, myOffset, myBufferSize, myBuffer)) {
+		if (MYRANK == MASTER_RANK)
+			fprintf(stderr,
+				"MPI-IO read failed, falling back to pread\n");
 
-	// Then copy the number string
-	for (int j = 0; j < strlen(num); ++j) {
-		dataFileName[cutoff + j] = num[j];
-		metaFileName[cutoff + j] = num[j];
+		if (readFileRange(inputFileName, myOffset, myBufferSize,
+				  myBuffer)) {
+			fprintf(stderr,
+				"Error reading input file \"%s\" on rank %d\n",
+				inputFileName, MYRANK);
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
 	}
 
-	// Now copy the .data and .meta
-	for (int j = 0; j < 5; ++j) {
-		dataFileName[cutoff + strlen(num) + j] = data[j];
-		metaFileName[cutoff + strlen(num) + j] = meta[j];
+	// Find the edges of my pieces, with one more slot on each side for
+	// the neighbouring pieces of the ranks before and after me
+	struct chunkEdge *edges = calloc(myNumPieces + 2, sizeof(*edges));
+	uint64_t *skipKeys = calloc(myNumPieces + 1, sizeof(*skipKeys));
+	struct chunk *myChunks = malloc(sizeof(*myChunks) * (myNumPieces + 1));
+
+	if (!edges || !skipKeys || !myChunks) {
+		fprintf(stderr, "Error allocating buffer for rank %d\n",
+			MYRANK);
+		MPI_Abort(MPI_COMM_WORLD, -1);
 	}
 
-	MPI_Barrier(MPI_COMM_WORLD);
+	struct pieceJobs jobs = {
+		.buffer = myBuffer,
+		.size = myBufferSize,
+		.pieceSize = pieceSize,
+		.keySize = keySize,
+		.useEntropy = useEntropy,
+		.numPieces = myNumPieces,
+		.edges = edges,
+		.skipKeys = skipKeys,
+		.chunks = myChunks,
+	};
+
+	pthread_mutex_init(&jobs.lock, NULL);
+	runPieceJobs(&jobs, numThreads);
+
+	// Swap edges with the ranks holding the pieces right before and
+	// right after mine, so runs crossing ranks can be stitched
+	int left = MPI_PROC_NULL, right = MPI_PROC_NULL;
+
+	if (myNumPieces > 0 && myFirst > 0)
+		left = pieceOwner(myFirst - 1, numPieces, NUMPROCS);
+	if (myNumPieces > 0 && myLast < numPieces)
+		right = pieceOwner(myLast, numPieces, NUMPROCS);
+
+	MPI_Sendrecv(&edges[myNumPieces], 4, MPI_UINT64_T, right, EDGE_TAG,
+		     &edges[0], 4, MPI_UINT64_T, left, EDGE_TAG, MPI_COMM_WORLD,
+		     MPI_STATUS_IGNORE);
+	MPI_Sendrecv(&edges[1], 4, MPI_UINT64_T, left, EDGE_TAG,
+		     &edges[myNumPieces + 1], 4, MPI_UINT64_T, right, EDGE_TAG,
+		     MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+	// skipKeys[i] leading keys of my i-th piece join the chunk before it,
+	// the last entry is for the first piece of the next rank
+	for (uint64_t i = 0; i <= myNumPieces; ++i) {
+		if ((i == 0 && left == MPI_PROC_NULL) ||
+		    (i == myNumPieces && right == MPI_PROC_NULL))
+			continue;
+
+		skipKeys[i] = stitchedKeys(&edges[i], &edges[i + 1]);
+	}
 
-	if (MYRANK == MASTER_RANK) {
-		// Get the size of the input file
-		inputFileSize = getFileSize(inputFileName);
-		printf("Input file size: %lu\n", inputFileSize);
+	// Compress my pieces into chunks on the thread pool, then pack them
+	// one after the other in order
+	struct chunkInfo *myIndex = malloc(sizeof(*myIndex) * (myNumPieces + 1));
+	unsigned char *myBytes = NULL;
+	uint64_t mySize = 0;
 
-		// Calculate buffer size
-		bufferSize = inputFileSize / NUMPROCS;
-		myBufferSize = bufferSize;
+	if (!myIndex) {
+		fprintf(stderr, "Error allocating buffer for rank %d\n",
+			MYRANK);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
 
-		// Send buffer size to everyone except last rank, who will get
-		// buff + remainder
-		for (int i = 1; i < NUMPROCS - 1; i++) {
-			MPI_Send(&bufferSize, 1, MPI_UNSIGNED_LONG, i,
-				 BUFFER_SIZE_TAG, MPI_COMM_WORLD);
-		}
+	jobs.compress = 1;
+	if (runPieceJobs(&jobs, numThreads)) {
+		fprintf(stderr, "Error compressing slice of rank %d\n",
+			MYRANK);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
 
-		// Send buffer size to last rank
-		bufferSize += inputFileSize % NUMPROCS;
-		MPI_Send(&bufferSize, 1, MPI_UNSIGNED_LONG, NUMPROCS - 1,
-			 BUFFER_SIZE_TAG, MPI_COMM_WORLD);
-	} else {
-		MPI_Recv(&recvBufferSize, 1, MPI_UNSIGNED_LONG, MASTER_RANK,
-			 BUFFER_SIZE_TAG, MPI_COMM_WORLD, &status);
-		myBufferSize = recvBufferSize;
+	pthread_mutex_destroy(&jobs.lock);
+	free(myBuffer);
+	free(edges);
+	free(skipKeys);
+
+	for (uint64_t i = 0; i < myNumPieces; ++i) {
+		myIndex[i] = myChunks[i].info;
+		myIndex[i].offset = mySize;
+		mySize += myChunks[i].size;
 	}
 
-	// Everybody sets up their own buffer
-	myBuffer = malloc(sizeof(unsigned char) * myBufferSize);
-	if (!myBuffer) {
+	myBytes = malloc(mySize + 1);
+	if (!myBytes) {
 		fprintf(stderr, "Error allocating buffer for rank %d\n",
 			MYRANK);
 		MPI_Abort(MPI_COMM_WORLD, -1);
 	}
 
-	// Wait for all processes to set their buffer
-	MPI_Barrier(MPI_COMM_WORLD);
+	for (uint64_t i = 0; i < myNumPieces; ++i) {
+		memcpy(myBytes + myIndex[i].offset, myChunks[i].bytes,
+		       myChunks[i].size);
+		free(myChunks[i].bytes);
+	}
 
-	if (MYRANK == MASTER_RANK) {
-		// Read the input
-		fileBuffer = malloc(sizeof(unsigned char) * bufferSize);
+	free(myChunks);
 
-		if (!fileBuffer) {
-			fprintf(stderr,
-				"Error allocating read buffer, not enough memory!\n");
-			MPI_Abort(MPI_COMM_WORLD, -1);
-		}
+	// My chunks go right after the chunks of all the ranks before me
+	uint64_t myChunkOffset = 0, chunksEnd = 0;
+
+	MPI_Exscan(&mySize, &myChunkOffset, 1, MPI_UINT64_T, MPI_SUM,
+		   MPI_COMM_WORLD);
+	if (MYRANK == MASTER_RANK)
+		myChunkOffset = 0; // MPI_Exscan leaves rank 0 undefined
 
-		// Save 1 element for later. Possibly use fseek later.
-		fread(fileBuffer, myBufferSize, 1, inputFile);
+	myChunkOffset += CONTAINER_HEADER_SIZE;
+	for (uint64_t i = 0; i < myNumPieces; ++i)
+		myIndex[i].offset += myChunkOffset;
 
-		// Read and send a buffer to every process except the last one
-		for (int i = 1; i < NUMPROCS - 1; i++) {
-			fread(fileBuffer, myBufferSize, 1, inputFile);
+	MPI_Allreduce(&mySize, &chunksEnd, 1, MPI_UINT64_T, MPI_SUM,
+		      MPI_COMM_WORLD);
+	chunksEnd += CONTAINER_HEADER_SIZE;
 
-			MPI_Send(fileBuffer, myBufferSize, MPI_UNSIGNED_CHAR, i,
-				 SEND_BUFFER_TAG, MPI_COMM_WORLD);
-		}
+	// Master collects the index entries of every chunk, it knows how
+	// many pieces every rank got
+	struct chunkInfo *index = NULL;
+	int *recvCounts = NULL, *displs = NULL;
 
-		// Read and send a buffer to the last process
-		if (NUMPROCS > 1) {
-			fread(fileBuffer, bufferSize, 1, inputFile);
+	if (MYRANK == MASTER_RANK) {
+		index = malloc(sizeof(*index) * (numPieces + 1));
+		recvCounts = malloc(sizeof(int) * NUMPROCS);
+		displs = malloc(sizeof(int) * NUMPROCS);
 
-			MPI_Send(fileBuffer, bufferSize, MPI_UNSIGNED_CHAR,
-				 NUMPROCS - 1, SEND_BUFFER_TAG, MPI_COMM_WORLD);
+		if (!index || !recvCounts || !displs) {
+			fprintf(stderr,
+				"Error allocating chunk index, not enough memory!\n");
+			MPI_Abort(MPI_COMM_WORLD, -1);
 		}
 
-		// Go back to the beginning of the file and read the first
-		// buffer
-		fseek(inputFile, 0, SEEK_SET);
-		fread(fileBuffer, myBufferSize, 1, inputFile);
-
-		// Setup my buffer info
-		myBuffer = fileBuffer;
-	} else {
-		// Receive the buffer
-		MPI_Recv(myBuffer, myBufferSize, MPI_UNSIGNED_CHAR, MASTER_RANK,
-			 SEND_BUFFER_TAG, MPI_COMM_WORLD, &status);
-	}
+		for (int r = 0; r < NUMPROCS; ++r) {
+			uint64_t first = numPieces * r / NUMPROCS;
+			uint64_t last = numPieces * (r + 1) / NUMPROCS;
 
-	// Calculate my portion of the work
-	struct buffIter myIter;
-	struct writeBuff metaWriter;
-	struct writeBuff dataWriter;
-	unsigned long lastPos = 0;
-	unsigned long unusedBits = 0;
-
-	uint64_t next = 0;
-	uint64_t last = 0;
-	uint64_t count = 1;
-
-	myDataFile = fopen(dataFileName, "wb");
-	myMetaFile = fopen(metaFileName, "wb");
-
-	initDataFile(myDataFile, keySize);
-	initWriteBuff(&dataWriter, myDataFile, keySize);
-	initBuffIter(&myIter, myBuffer, myBufferSize, keySize);
-	u64array_init(&counts);
-
-	advance(&myIter, &next);
-	last = next;
-
-	// Go through the buffer
-	while (iterHasNext(&myIter)) {
-		advance(&myIter, &next);
-
-		// If we have a match, keep running
-		if (next == last)
-			++count;
-		// If they don't match, write 'last' and 'count' to our files
-		else {
-			u64array_push_back(&counts, count);
-			pushToWriteBuff(&dataWriter, last);
-
-			count = 1;
+			recvCounts[r] = (int)(3 * (last - first));
+			displs[r] = (int)(3 * first);
 		}
-
-		last = next;
 	}
 
-	// Here we account for unused bits from the buffer
-	// This should actually be some wonky number
-	unusedBits = unusedBuffBits(&myIter);
+	MPI_Gatherv(myIndex, (int)(3 * myNumPieces), MPI_UINT64_T, index,
+		    recvCounts, displs, MPI_UINT64_T, MASTER_RANK,
+		    MPI_COMM_WORLD);
+
+	// Write all the chunks at once, master also writes the archive header
+	// and, past the last chunk, the index
+	MPI_File fh;
+	int err = 0, anyErr;
+
+	if (MPI_File_open(MPI_COMM_WORLD, outputFileName,
+			  MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+			  &fh) != MPI_SUCCESS) {
+		if (MYRANK == MASTER_RANK)
+			fprintf(stderr, "Error creating archive \"%s\"\n",
+				outputFileName);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
 
-	closeWriteBuff(&dataWriter);
+	err = writeSliceMPI(fh, myChunkOffset, myBytes, mySize);
 
-	// Now write to the meta file
-	unsigned int numBits = 64;
+	if (MYRANK == MASTER_RANK) {
+		uint64_t tailSize = numPieces * INDEX_ENTRY_SIZE + TRAILER_SIZE;
+		unsigned char header[CONTAINER_HEADER_SIZE];
+		unsigned char *tail = malloc(tailSize);
 
-	for (unsigned int i = 0; i < 64; ++i) {
-		if ((counts.biggest << i) & 0x8000000000000000) {
-			numBits = 64 - i;
-			break;
+		if (!tail) {
+			fprintf(stderr,
+				"Error allocating chunk index, not enough memory!\n");
+			MPI_Abort(MPI_COMM_WORLD, -1);
 		}
-	}
 
-	// Write the num of bits to the meta file
-	initMetaFile(myMetaFile, numBits, counts.n, NUMPROCS);
+		makeContainerHeader(header, keySize);
+		makeIndex(tail, index, numPieces, chunksEnd);
 
-	// Now write the array elements to the meta file at the given bit level
-	// Create chars of the elements.
+		if (MPI_File_write_at(fh, 0, header, CONTAINER_HEADER_SIZE,
+				      MPI_UNSIGNED_CHAR,
+				      MPI_STATUS_IGNORE) != MPI_SUCCESS ||
+		    MPI_File_write_at(fh, (MPI_Offset)chunksEnd, tail,
+				      (int)tailSize, MPI_UNSIGNED_CHAR,
+				      MPI_STATUS_IGNORE) != MPI_SUCCESS)
+			err = 1;
 
-	// For each array element convert it to the numBits format,
-	// string them together to then write them as chars.
-	initWriteBuff(&metaWriter, myMetaFile, numBits);
-
-	for (unsigned long i = 0; i < counts.n; ++i)
-		pushToWriteBuff(&metaWriter, counts.data[i] << (64 - numBits));
+		free(tail);
+	}
 
-	closeWriteBuff(&metaWriter);
+	// Drop anything left over from an older, longer archive
+	uint64_t archiveSize =
+		chunksEnd + numPieces * INDEX_ENTRY_SIZE + TRAILER_SIZE;
 
-	// Stop it all
-	MPI_Barrier(MPI_COMM_WORLD);
+	if (MPI_File_set_size(fh, (MPI_Offset)archiveSize) != MPI_SUCCESS)
+		err = 1;
 
-	// Free all the memory and close files
-	free(myBuffer);
+	MPI_File_close(&fh);
 
-	free(counts.data);
-	free(dataFileName);
-	free(metaFileName);
+	MPI_Allreduce(&err, &anyErr, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+	if (anyErr) {
+		if (MYRANK == MASTER_RANK)
+			fprintf(stderr, "Error writing archive \"%s\"\n",
+				outputFileName);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
 
-	fclose(myDataFile);
-	fclose(myMetaFile);
+	// Free all the memory
+	free(myBytes);
+	free(myIndex);
+	free(index);
+	free(recvCounts);
+	free(displs);
+	free(outputFileName);
 
-	// Close input file and say final time
+	// Say final time
 	if (MYRANK == MASTER_RANK) {
-		// Close the input file
-		fclose(inputFile);
-
 		// Print elapsed time
 		struct timeval elapsedTime;
 
@@ -0,0 +1,508 @@
+// SPDX-License-Identifier: GPL-3.0
+
+#include <inttypes.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define RUN_SCAN_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RUN_SCAN_NEON
+#endif
+
+#include "../include/runScan.h"
+
+// Loads a key of keyBytes bytes, left-aligned like advance() returns it
+static inline uint64_t loadKey(const unsigned char *ptr, unsigned int keyBytes)
+{
+	uint64_t key = 0;
+
+	// Constant sizes let the compiler turn memcpy into a single load
+	switch (keyBytes) {
+	case 1:
+		memcpy(&key, ptr, 1);
+		break;
+	case 2:
+		memcpy(&key, ptr, 2);
+		break;
+	case 4:
+		memcpy(&key, ptr, 4);
+		break;
+	case 8:
+		memcpy(&key, ptr, 8);
+		break;
+	default:
+		memcpy(&key, ptr, keyBytes);
+		break;
+	}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return __builtin_bswap64(key);
+#else
+	return key;
+#endif
+}
+
+#if defined(RUN_SCAN_X86) || defined(RUN_SCAN_NEON)
+// Folds a mask of laneBits-wide lanes, made of byteBits-wide groups, so that
+// the lowest bit of every lane is set if any bit of the lane was, then keeps
+// only those lowest bits
+static inline uint64_t foldLanes(uint64_t mask, unsigned int byteBits,
+				 unsigned int laneBits)
+{
+	for (unsigned int s = byteBits; s < laneBits; s <<= 1)
+		mask |= mask >> s;
+
+	return laneBits < 64 ? mask & (~0ULL / ((1ULL << laneBits) - 1)) :
+			       mask & 1;
+}
+
+// Appends to ends the key of every set bit of mask, a bit every
+// 1 << bitShift standing for one key from firstKey on
+static inline unsigned long pushBoundaries(uint64_t mask,
+					   unsigned long firstKey,
+					   unsigned int bitShift,
+					   uint64_t *ends)
+{
+	unsigned long found = 0;
+
+	while (mask) {
+		ends[found++] = firstKey + (__builtin_ctzll(mask) >> bitShift);
+		mask &= mask - 1;
+	}
+
+	return found;
+}
+#endif
+
+/*
+ * The boundary kernels below append to ends the index i of every key
+ * differing from key i + 1, for the first keys of p, and tell in *next where
+ * they stopped. Each block of keys is compared against the same block
+ * shifted by one key, and never reads past the n keys of p.
+ */
+
+#ifdef RUN_SCAN_X86
+static unsigned long boundariesSSE2(const unsigned char *p, unsigned long n,
+				    unsigned int keyBytes,
+				    unsigned int keyShift, uint64_t *ends,
+				    unsigned long *next)
+{
+	unsigned long bytes = (n - 1) * keyBytes, off, found = 0;
+
+	for (off = 0; off + 16 <= bytes; off += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(p + off));
+		__m128i b = _mm_loadu_si128((const __m128i *)(p + off +
+							      keyBytes));
+		uint64_t ne = (uint16_t)~_mm_movemask_epi8(
+			_mm_cmpeq_epi8(a, b));
+
+		ne = foldLanes(ne, 1, keyBytes);
+		found += pushBoundaries(ne, off >> keyShift, keyShift,
+					ends + found);
+	}
+
+	*next = off >> keyShift;
+	return found;
+}
+
+__attribute__((target("avx2")))
+static unsigned long boundariesAVX2(const unsigned char *p, unsigned long n,
+				    unsigned int keyBytes,
+				    unsigned int keyShift, uint64_t *ends,
+				    unsigned long *next)
+{
+	unsigned long bytes = (n - 1) * keyBytes, off, found = 0;
+
+	for (off = 0; off + 32 <= bytes; off += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(p + off));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(p + off +
+								 keyBytes));
+		uint64_t ne = (uint32_t)~_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(a, b));
+
+		ne = foldLanes(ne, 1, keyBytes);
+		found += pushBoundaries(ne, off >> keyShift, keyShift,
+					ends + found);
+	}
+
+	*next = off >> keyShift;
+	return found;
+}
+
+__attribute__((target("avx512bw")))
+static unsigned long boundariesAVX512(const unsigned char *p, unsigned long n,
+				      unsigned int keyBytes,
+				      unsigned int keyShift, uint64_t *ends,
+				      unsigned long *next)
+{
+	unsigned long bytes = (n - 1) * keyBytes, off, found = 0;
+
+	for (off = 0; off + 64 <= bytes; off += 64) {
+		__m512i a = _mm512_loadu_si512(p + off);
+		__m512i b = _mm512_loadu_si512(p + off + keyBytes);
+		uint64_t ne;
+
+		// Compare whole keys, giving one mask bit per key
+		switch (keyBytes) {
+		case 1:
+			ne = _mm512_cmpneq_epi8_mask(a, b);
+			break;
+		case 2:
+			ne = _mm512_cmpneq_epi16_mask(a, b);
+			break;
+		case 4:
+			ne = _mm512_cmpneq_epi32_mask(a, b);
+			break;
+		default:
+			ne = _mm512_cmpneq_epi64_mask(a, b);
+			break;
+		}
+
+		found += pushBoundaries(ne, off >> keyShift, 0, ends + found);
+	}
+
+	*next = off >> keyShift;
+	return found;
+}
+#endif
+
+#ifdef RUN_SCAN_NEON
+static unsigned long boundariesNEON(const unsigned char *p, unsigned long n,
+				    unsigned int keyBytes,
+				    unsigned int keyShift, uint64_t *ends,
+				    unsigned long *next)
+{
+	unsigned long bytes = (n - 1) * keyBytes, off, found = 0;
+
+	for (off = 0; off + 16 <= bytes; off += 16) {
+		uint8x16_t eq = vceqq_u8(vld1q_u8(p + off),
+					 vld1q_u8(p + off + keyBytes));
+		// Narrow the comparison to four mask bits per byte
+		uint8x8_t bits = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+		uint64_t ne = ~vget_lane_u64(vreinterpret_u64_u8(bits), 0);
+
+		ne = foldLanes(ne, 4, keyBytes * 4);
+		found += pushBoundaries(ne, off >> keyShift, keyShift + 2,
+					ends + found);
+	}
+
+	*next = off >> keyShift;
+	return found;
+}
+#endif
+
+// Portable kernel, also used to finish the keys left by the vector ones
+static unsigned long boundariesScalar(const unsigned char *p,
+				      unsigned long from, unsigned long n,
+				      unsigned int keyBytes, uint64_t *ends)
+{
+	unsigned long found = 0;
+	uint64_t prev = loadKey(p + from * keyBytes, keyBytes), next;
+
+	for (unsigned long i = from; i + 1 < n; ++i) {
+		next = loadKey(p + (i + 1) * keyBytes, keyBytes);
+		if (next != prev)
+			ends[found++] = i;
+		prev = next;
+	}
+
+	return found;
+}
+
+// Finds the run boundaries among n keys of keyBytes bytes each
+static unsigned long findBoundaries(const unsigned char *p, unsigned long n,
+				    unsigned int keyBytes, uint64_t *ends)
+{
+	unsigned long found = 0, next = 0;
+
+	// Vector kernels need keys tiling their blocks
+	if (keyBytes == 1 || keyBytes == 2 || keyBytes == 4 || keyBytes == 8) {
+		unsigned int keyShift = __builtin_ctz(keyBytes);
+
+#if defined(RUN_SCAN_X86)
+		if (__builtin_cpu_supports("avx512bw"))
+			found = boundariesAVX512(p, n, keyBytes, keyShift, ends,
+						 &next);
+		else if (__builtin_cpu_supports("avx2"))
+			found = boundariesAVX2(p, n, keyBytes, keyShift, ends,
+					       &next);
+		else
+			found = boundariesSSE2(p, n, keyBytes, keyShift, ends,
+					       &next);
+#elif defined(RUN_SCAN_NEON)
+		found = boundariesNEON(p, n, keyBytes, keyShift, ends, &next);
+#else
+		(void)keyShift;
+#endif
+	}
+
+	return found + boundariesScalar(p, next, n, keyBytes, ends + found);
+}
+
+// Kernel for byte-aligned keys, p holds n >= 1 whole keys
+static unsigned long scanBytes(struct runScan *scan, const unsigned char *p,
+			       unsigned long n, unsigned int keyBytes,
+			       uint64_t *runKeys, uint64_t *runCounts)
+{
+	unsigned long numRuns = 0, numEnds, start = 0;
+
+	// The open run ends right away if the first key does not extend it
+	if (scan->count > 0 && scan->last != loadKey(p, keyBytes)) {
+		runKeys[0] = scan->last;
+		runCounts[0] = scan->count;
+		scan->count = 0;
+		numRuns = 1;
+	}
+
+	// Boundaries land in runCounts, then become run lengths in place
+	numEnds = findBoundaries(p, n, keyBytes, runCounts + numRuns);
+
+	for (unsigned long r = numRuns; r < numRuns + numEnds; ++r) {
+		uint64_t end = runCounts[r];
+
+		runKeys[r] = loadKey(p + end * keyBytes, keyBytes);
+		runCounts[r] = scan->count + end - start + 1;
+		scan->count = 0;
+		start = end + 1;
+	}
+
+	scan->last = loadKey(p + (n - 1) * keyBytes, keyBytes);
+	scan->count += n - start;
+
+	return numRuns + numEnds;
+}
+
+// Loads the 64 bits starting at bit pos of the buffer, zeros past its end
+static inline uint64_t loadBits(const unsigned char *buffer,
+				unsigned long size, unsigned long pos)
+{
+	unsigned long byte = pos / 8;
+	unsigned int shift = pos % 8;
+	uint64_t word;
+	unsigned char next;
+
+	if (byte + 9 <= size) {
+		word = loadKey(buffer + byte, 8);
+		next = buffer[byte + 8];
+	} else {
+		unsigned char tail[9] = { 0 };
+
+		if (byte < size)
+			memcpy(tail, buffer + byte, size - byte);
+		word = loadKey(tail, 8);
+		next = tail[8];
+	}
+
+	return shift ? (word << shift) | (next >> (8 - shift)) : word;
+}
+
+/*
+ * Finds the run boundaries among n keys of keySize bits from bit start on,
+ * along with the key ending each run. Key i differs from key i + 1 exactly
+ * when the stream XORed with itself shifted by keySize bits has a set bit
+ * among the keySize bits of key i, so every 64-bit window of that XOR
+ * covering only equal keys is skipped at once and only the boundaries cost
+ * a clz each.
+ */
+static unsigned long findBitBoundaries(const unsigned char *buffer,
+				       unsigned long size, unsigned long start,
+				       unsigned long n, unsigned int keySize,
+				       uint64_t *ends, uint64_t *endKeys)
+{
+	uint64_t keyMask = keySize < 64 ? ~(~0ULL >> keySize) : ~0ULL;
+	unsigned int keysPerWord = 64 / keySize;
+	unsigned char keyAt[64];
+	unsigned long found = 0, i = 0;
+	unsigned long pos = start;
+	uint64_t word = loadBits(buffer, size, pos), shifted;
+
+	// Key holding each bit of a window, saves a division per boundary
+	for (unsigned int b = 0; b < 64; ++b)
+		keyAt[b] = b / keySize;
+
+	while (i + 1 < n) {
+		unsigned int keys = n - 1 - i < keysPerWord ? n - 1 - i :
+							       keysPerWord;
+		unsigned int bits = keys * keySize;
+		uint64_t diff;
+
+		shifted = loadBits(buffer, size, pos + keySize);
+		diff = word ^ shifted;
+		if (bits < 64)
+			diff &= ~(~0ULL >> bits);
+
+		// Every set bit left marks a key differing from the next one,
+		// and the window holds all of that key
+		while (diff) {
+			unsigned int key = keyAt[__builtin_clzll(diff)];
+			unsigned int done = (key + 1) * keySize;
+
+			ends[found] = i + key;
+			endKeys[found++] = (word << (done - keySize)) & keyMask;
+			diff = done < 64 ? diff & (~0ULL >> done) : 0;
+		}
+
+		i += keys;
+		pos += bits;
+
+		// With one key per window the next window was just loaded
+		word = bits == keySize ? shifted : loadBits(buffer, size, pos);
+	}
+
+	return found;
+}
+
+// Kernel for any key size, n >= 1 keys from bit start on
+static unsigned long scanBits(struct runScan *scan, unsigned char *buffer,
+			      unsigned long size, unsigned long start,
+			      unsigned long n, unsigned int keySize,
+			      uint64_t *runKeys, uint64_t *runCounts)
+{
+	uint64_t keyMask = keySize < 64 ? ~(~0ULL >> keySize) : ~0ULL;
+	unsigned long numRuns = 0, numEnds, first = 0;
+
+	// The open run ends right away if the first key does not extend it
+	if (scan->count > 0 &&
+	    scan->last != (loadBits(buffer, size, start) & keyMask)) {
+		runKeys[0] = scan->last;
+		runCounts[0] = scan->count;
+		scan->count = 0;
+		numRuns = 1;
+	}
+
+	// Boundaries land in runCounts, then become run lengths in place
+	numEnds = findBitBoundaries(buffer, size, start, n, keySize,
+				    runCounts + numRuns, runKeys + numRuns);
+
+	for (unsigned long r = numRuns; r < numRuns + numEnds; ++r) {
+		uint64_t end = runCounts[r];
+
+		runCounts[r] = scan->count + end - first + 1;
+		scan->count = 0;
+		first = end + 1;
+	}
+
+	scan->last = loadBits(buffer, size, start + (n - 1) * keySize) &
+		     keyMask;
+	scan->count += n - first;
+
+	return numRuns + numEnds;
+}
+
+// Kernel for 1-bit keys. Run lengths are read straight off 64-bit words
+// with clz, a word all made of the open run's bit costs a single step.
+static unsigned long scanOneBit(struct runScan *scan, unsigned char *buffer,
+				unsigned long size, unsigned long start,
+				unsigned long n, uint64_t *runKeys,
+				uint64_t *runCounts)
+{
+	const uint64_t topBit = 1ULL << 63;
+	uint64_t last = scan->last, count = scan->count;
+	unsigned long numRuns = 0;
+
+	if (count == 0)
+		last = loadBits(buffer, size, start) & topBit;
+
+	while (n > 0) {
+		unsigned int bits, used = 0;
+		uint64_t word;
+
+		// Whole words of the open run's bit are only compared, the order
+		// of their bytes does not matter
+		if (start % 8 == 0) {
+			const uint64_t fill = last ? ~0ULL : 0;
+			uint64_t raw;
+
+			while (n >= 64 && start / 8 + 8 <= size) {
+				memcpy(&raw, buffer + start / 8, 8);
+				if (raw != fill)
+					break;
+				count += 64;
+				start += 64;
+				n -= 64;
+			}
+
+			if (n == 0)
+				break;
+		}
+
+		bits = n < 64 ? n : 64;
+		word = loadBits(buffer, size, start);
+
+		while (used < bits) {
+			// Set bits are the ones ending the open run
+			uint64_t diff = (last ? ~word : word) << used;
+			unsigned int len;
+
+			if (bits - used < 64)
+				diff &= ~(~0ULL >> (bits - used));
+
+			if (!diff) {
+				count += bits - used;
+				break;
+			}
+
+			len = __builtin_clzll(diff);
+			runKeys[numRuns] = last;
+			runCounts[numRuns++] = count + len;
+
+			last ^= topBit;
+			count = 0;
+			used += len;
+		}
+
+		start += bits;
+		n -= bits;
+	}
+
+	scan->last = last;
+	scan->count = count;
+	return numRuns;
+}
+
+void initRunScan(struct runScan *scan)
+{
+	scan->last = 0;
+	scan->count = 0;
+}
+
+unsigned long findRuns(struct runScan *scan, unsigned char *buffer,
+		       unsigned long size, unsigned long startBit,
+		       unsigned long numKeys, unsigned int keySize,
+		       uint64_t *runKeys, uint64_t *runCounts)
+{
+	unsigned long numRuns = 0;
+
+	if (numKeys == 0)
+		return 0;
+
+	if (keySize == 1)
+		return scanOneBit(scan, buffer, size, startBit, numKeys,
+				  runKeys, runCounts);
+
+	if (keySize % 8 == 0 && startBit % 8 == 0) {
+		unsigned int keyBytes = keySize / 8;
+		unsigned long wholeKeys = (size - startBit / 8) / keyBytes;
+
+		if (wholeKeys > numKeys)
+			wholeKeys = numKeys;
+
+		if (wholeKeys > 0)
+			numRuns = scanBytes(scan, buffer + startBit / 8,
+					    wholeKeys, keyBytes, runKeys,
+					    runCounts);
+
+		// Only a last key cut by the end of the buffer is left
+		startBit += wholeKeys * keySize;
+		numKeys -= wholeKeys;
+	}
+
+	if (numKeys > 0)
+		numRuns += scanBits(scan, buffer, size, startBit, numKeys,
+				    keySize, runKeys + numRuns,
+				    runCounts + numRuns);
+
+	return numRuns;
+}
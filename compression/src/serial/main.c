@@ -1,43 +1,84 @@
 // SPDX-License-Identifier: GPL-3.0
 
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include "../../include/common.h"
-#include "../../include/buffIter.h"
-#include "../../include/writeBuff.h"
+#include "../../include/compressor.h"
+#include "../../include/container.h"
 
 /*
  * Command line arguments:
  *
- * 1) Input File Name --- File to Compress
- * 2) Key size --- Number of bits to encode at a time
+ * 1) Input File Name --- File to Compress, "-" for the standard input
+ * 2) Key size --- Number of bits to encode at a time, "auto" for every chunk
+ *    to pick the size compressing it best
+ * 3) Archive Name --- Optional, "-" for the standard output. Defaults to the
+ *    input name with a .rle extension, or the standard output when reading
+ *    the standard input.
+ *
+ * "--entropy" anywhere also runs both streams of every chunk through the
+ * Huffman stage.
  */
 
-// Measured in bytes
-#define BUFFER_SIZE 2000
-
-void initMetaFile(FILE *metaFile, unsigned int lengthOfRunInBits,
-		  unsigned long numRuns)
+/*
+ * Input of the compressor: the whole file mapped in memory or, if it cannot
+ * be mapped, read one piece at a time into two buffers used in turn. Pipes
+ * and the standard input are streamed the same way, so memory stays bounded
+ * to two pieces whatever the size of the input.
+ */
+struct input {
+	char *name;                     /**< Name of the input file. */
+	FILE *stream;                   /**< Input read sequentially, NULL if it is seekable. */
+	unsigned long size;             /**< Size of the input in bytes, unknown when streamed. */
+	unsigned long pieceSize;        /**< Size of a piece in bytes. */
+	unsigned char *map;             /**< The mapped input, NULL if not mapped. */
+	unsigned char *buffers[2];      /**< Read buffers used without a mapping. */
+};
+
+// Points piece at piece idx of the input and sets its size, 0 past the end
+// of the input. A streamed input must be asked its pieces in order.
+// Returns 0 on success, -1 on a read error.
+static int getPiece(struct input *in, unsigned long idx, unsigned char **piece,
+		    unsigned long *size)
 {
-	// Write first 48 bits as all zeros
-	for (int i = 1; i <= 6; ++i) {
-		unsigned char chunk = (numRuns >> (48 - i * 8)) & 0xFF;
+	unsigned long offset = idx * in->pieceSize;
 
-		fputc(chunk, metaFile);
+	*piece = in->buffers[idx % 2];
+
+	if (in->stream) {
+		// fread() only comes back short at the end of the input
+		*size = fread(*piece, 1, in->pieceSize, in->stream);
+		return ferror(in->stream) ? -1 : 0;
 	}
 
-	// Write next 8 bits as the length of a run in bits
-	fputc((int)lengthOfRunInBits, metaFile);
+	*size = offset >= in->size ? 0 : in->size - offset;
+	if (*size > in->pieceSize)
+		*size = in->pieceSize;
+
+	if (in->map) {
+		*piece = in->map + offset;
+		return 0;
+	}
+
+	return readFileRange(in->name, offset, *size, *piece);
 }
 
-void initDataFile(FILE *dataFile, unsigned int keySize)
+// Key size of a piece, picked for it in adaptive mode
+static unsigned int pieceKeySize(unsigned char *piece, unsigned long size,
+				 unsigned int keySize)
 {
-	// Write first 8 bits as keySize
-	fputc(keySize, dataFile);
+	if (keySize != ADAPTIVE_KEY_SIZE)
+		return keySize;
+
+	return pickKeySize(piece, size);
 }
 
 int main(int argc, char *argv[])
@@ -46,214 +87,238 @@ int main(int argc, char *argv[])
 
 	gettimeofday(&tvStart, 0);
 
-	char *inputFileName, *dataFileName, *metaFileName;
+	char *inputFileName, *outputFileName;
 	unsigned int keySize;
-	FILE *inputFile, *dataFile, *metaFile;
-	size_t inputNameLength, cutoff;
+	FILE *outputFile, *msg = stdout;
+	int useEntropy = 0, numArgs = 1;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--entropy"))
+			useEntropy = 1;
+		else
+			argv[numArgs++] = argv[i];
+	}
+	argc = numArgs;
 
-	if (argc != 3) {
+	if (argc != 3 && argc != 4) {
 		fprintf(stderr,
-			"Invalid number of input arguments. Got %d, expected 2.\n",
+			"Invalid number of input arguments. Got %d, expected 2 or 3.\n",
 			(argc - 1));
 		fprintf(stderr,
-			"Expected Arguments:\n(1) Input File Name\n(2) Key size in bitse\n");
+			"Expected Arguments:\n(1) Input File Name, - for stdin\n(2) Key size in bits, auto for per-chunk\n(3) Archive Name, - for stdout (optional)\n--entropy to Huffman code the streams\n");
 		return -1;
 	}
 
-	sscanf(argv[2], "%d", &keySize);
-
-	if (keySize < 1 || keySize > 64) {
+	if (!strcmp(argv[2], "auto")) {
+		keySize = ADAPTIVE_KEY_SIZE;
+	} else if (sscanf(argv[2], "%u", &keySize) != 1 || keySize < 1 ||
+		   keySize > 64) {
 		fprintf(stderr,
-			"Invalid key size \"%d\"; must be in range of [1, 64]",
-			keySize);
+			"Invalid key size \"%s\"; must be in range of [1, 64]\n",
+			argv[2]);
 		return -1;
 	}
 
 	inputFileName = argv[1];
-	inputNameLength = strlen(inputFileName);
-
-	// Get the number of chars to take before the
-	// first '.' of the given inputFileName
-	cutoff = (strchr(inputFileName, '.')) - &(inputFileName[0]);
 
-	dataFileName = (char *)malloc(sizeof(char) * (cutoff + 5));
-	metaFileName = (char *)malloc(sizeof(char) * (cutoff + 5));
+	if (argc == 4)
+		outputFileName = strdup(argv[3]);
+	else if (!strcmp(inputFileName, "-"))
+		outputFileName = strdup("-");
+	else
+		outputFileName = archiveName(inputFileName);
 
-	// Make a copy of the input file name with
-	// all the chars before the '.' extension
-	memmove(dataFileName, inputFileName, cutoff);
-	memmove(metaFileName, inputFileName, cutoff);
+	if (!outputFileName) {
+		fprintf(stderr, "Not enough memory!\n");
+		return -1;
+	}
 
-	strcat(dataFileName, ".data");
-	strcat(metaFileName, ".meta");
+	// Messages must not end up in an archive written to stdout
+	if (!strcmp(outputFileName, "-"))
+		msg = stderr;
 
 	// Print some updates for the user
-	printf("Producing files named: %s and %s\n", dataFileName,
-	       metaFileName);
-	printf("keySize = %d bits\n", keySize);
+	fprintf(msg, "Producing archive named: %s\n", outputFileName);
+	if (keySize == ADAPTIVE_KEY_SIZE)
+		fprintf(msg, "keySize = picked for every chunk\n");
+	else
+		fprintf(msg, "keySize = %d bits\n", keySize);
 
 	// Now let's create the files we will read and write to
-	inputFile = fopen(inputFileName, "rb");
-	dataFile = fopen(dataFileName, "wb");
-	metaFile = fopen(metaFileName, "wb");
+	struct input in = { .name = inputFileName };
+	struct stat st;
+	int inputFd = !strcmp(inputFileName, "-") ? STDIN_FILENO :
+						   open(inputFileName, O_RDONLY);
 
-	if (!inputFile) {
+	if (inputFd < 0 || fstat(inputFd, &st)) {
 		fprintf(stderr, "Error opening input file \"%s\"\n",
 			inputFileName);
 		return -1;
 	}
 
-	if (!dataFile || !metaFile) {
-		fprintf(stderr, "Error creating data and meta files\n");
-		return -1;
-	}
-
-	unsigned char *buffer = malloc(sizeof(unsigned char) * BUFFER_SIZE);
+	if (msg == stderr)
+		outputFile = stdout;
+	else
+		outputFile = fopen(outputFileName, "wb");
 
-	if (!buffer) {
-		fprintf(stderr,
-			"Error allocating read buffer, not enough memory!\n");
+	if (!outputFile) {
+		fprintf(stderr, "Error creating archive \"%s\"\n",
+			outputFileName);
 		return -1;
 	}
 
-	initDataFile(dataFile, keySize);
-
-	struct buffIter myIter;
-	struct writeBuff metaWriter;
-	struct writeBuff dataWriter;
-	unsigned long lastPos = 0;
-	unsigned long unusedBits = 0;
-
-	uint64_t next = 0;
-	uint64_t last = 0;
-	uint64_t count = 1;
-
-	struct u64array counts;
-
-	size_t validRead = fread(buffer, BUFFER_SIZE, 1, inputFile);
-
-	initWriteBuff(&dataWriter, dataFile, keySize);
-	initBuffIter(&myIter, buffer, BUFFER_SIZE, keySize);
-	u64array_init(&counts);
-
-	advance(&myIter, &next);
-	last = next;
-
-	// This portion reads the file by buffering char values
-	while (validRead == 1) {
-		unsigned long currPos = ftell(inputFile);
-
-		// Go through the buffer
-		while (iterHasNext(&myIter)) {
-			advance(&myIter, &next);
-
-			//If we have a match, keep running
-			if (next == last)
-				++count;
-			//If they don't match, write 'last' and 'count' to our files
-			else {
-				u64array_push_back(&counts, count);
-				pushToWriteBuff(&dataWriter, last);
-
-				count = 1;
-			}
-			last = next;
+	// Input is compressed one piece of pieceSize bytes at a time, in a
+	// single pass over the whole file mapped in memory. The next piece is
+	// looked at ahead to stitch runs crossing into it.
+	in.pieceSize = chunkBytes(keySize);
+
+	if (S_ISREG(st.st_mode)) {
+		in.size = st.st_size;
+	} else {
+		in.stream = fdopen(inputFd, "rb");
+		if (!in.stream) {
+			fprintf(stderr, "Error opening input file \"%s\"\n",
+				inputFileName);
+			return -1;
 		}
+	}
 
-		unusedBits = unusedBuffBits(&myIter);
+	if (!in.stream && in.size > 0) {
+		void *map = mmap(NULL, in.size, PROT_READ, MAP_PRIVATE,
+				 inputFd, 0);
 
-		// Need to change fread() to account for unused bits from this iteration
-		// Take the current position and move the file pointer back a few bytes
-		// based on how many unused bits there are.
-		fseek(inputFile, -(unusedBits / 8), SEEK_CUR);
+		if (map != MAP_FAILED) {
+			madvise(map, in.size, MADV_SEQUENTIAL);
+			in.map = map;
+		}
+	}
 
-		if (unusedBits % 8)
-			fseek(inputFile, -1, SEEK_CUR);
+	// Without a mapping, pieces are read into two buffers
+	if (!in.map) {
+		in.buffers[0] = malloc(in.pieceSize);
+		in.buffers[1] = malloc(in.pieceSize);
 
-		if (unusedBits)
-			unusedBits = 8 - (unusedBits % 8);
+		if (!in.buffers[0] || !in.buffers[1]) {
+			fprintf(stderr,
+				"Error allocating read buffer, not enough memory!\n");
+			return -1;
+		}
+	}
 
-		lastPos = ftell(inputFile);
+	unsigned char header[CONTAINER_HEADER_SIZE];
 
-		//Fill the buffer with the next set of contents
-		validRead = fread(buffer, BUFFER_SIZE, 1, inputFile);
-		setStartOffset(&myIter, unusedBits);
+	makeContainerHeader(header, keySize);
+	if (fwrite(header, 1, CONTAINER_HEADER_SIZE, outputFile) !=
+	    CONTAINER_HEADER_SIZE) {
+		fprintf(stderr, "Error writing archive \"%s\"\n",
+			outputFileName);
+		return -1;
 	}
 
-	if (counts.n == 0)
-		--count;
-
-	if (feof(inputFile)) {
-		unsigned long bytesLeft = ftell(inputFile) - lastPos;
+	struct chunk chunk;
+	struct chunkEdge edge, nextEdge;
+	struct chunkInfo *index = NULL;
+	uint64_t numChunks = 0, indexSize = 0, totalRuns = 0;
+	uint64_t offset = CONTAINER_HEADER_SIZE;
+	uint64_t skipKeys = 0, extraKeys;
+	unsigned long validRead, nextRead;
+	unsigned char *buffer, *nextBuffer;
+
+	if (getPiece(&in, 0, &buffer, &validRead)) {
+		fprintf(stderr, "Error reading input file \"%s\"\n",
+			inputFileName);
+		return -1;
+	}
+	getChunkEdge(buffer, validRead, pieceKeySize(buffer, validRead, keySize),
+		     NULL, &edge);
+
+	for (unsigned long p = 0; validRead; ++p) {
+		// Find out how much of the next piece continues our last run
+		if (getPiece(&in, p + 1, &nextBuffer, &nextRead)) {
+			fprintf(stderr, "Error reading input file \"%s\"\n",
+				inputFileName);
+			return -1;
+		}
 
-		initBuffIter(&myIter, buffer, bytesLeft, keySize);
+		extraKeys = 0;
+		if (nextRead) {
+			getChunkEdge(nextBuffer, nextRead,
+				     pieceKeySize(nextBuffer, nextRead,
+						  keySize),
+				     &edge, &nextEdge);
+			extraKeys = stitchedKeys(&edge, &nextEdge);
+		}
 
-		while (iterHasNext(&myIter)) {
-			last = next;
-			advance(&myIter, &next);
+		if (compressChunk(buffer, validRead, edge.keySize, skipKeys,
+				  extraKeys, useEntropy, &chunk)) {
+			fprintf(stderr, "Error compressing chunk %" PRIu64 "\n",
+				numChunks);
+			return -1;
+		}
 
-			// If we have a match, keep running
-			if (next == last)
-				++count;
-			// If they don't match, write 'last' and 'count' to our files
-			else {
-				u64array_push_back(&counts, count);
-				pushToWriteBuff(&dataWriter, last);
+		if (numChunks == indexSize) {
+			indexSize = indexSize ? indexSize * 2 : 16;
+			index = realloc(index, sizeof(*index) * indexSize);
 
-				count = 1;
+			if (!index) {
+				fprintf(stderr,
+					"Error allocating chunk index, not enough memory!\n");
+				return -1;
 			}
 		}
-	}
-
-	closeWriteBuff(&dataWriter);
-
-	// Now calculate the min bit size for the biggest element of the array.
-	unsigned int numBits = 64;
 
-	printf("Biggest run is: %" PRIu64 "\n", counts.biggest);
+		chunk.info.offset = offset;
+		index[numChunks++] = chunk.info;
 
-	for (unsigned int i = 0; i < 64; ++i) {
-		if ((counts.biggest << i) & 0x8000000000000000) {
-			numBits = 64 - i;
-			break;
+		if (fwrite(chunk.bytes, 1, chunk.size, outputFile) !=
+		    chunk.size) {
+			fprintf(stderr, "Error writing archive \"%s\"\n",
+				outputFileName);
+			return -1;
 		}
-	}
-
-	printf("Min num of bits is: %lu\n", numBits);
-
-	// Write the num of bits to the meta file
-	initMetaFile(metaFile, numBits, counts.n);
+		offset += chunk.size;
+		totalRuns += chunk.info.numRuns;
 
-	// Now write the array elements to the meta file at the given bit level
-	// Create chars of the elements.
+		free(chunk.bytes);
 
-	// For each array element convert it to the numBits format,
-	// string them together to then write them as chars.
-	initWriteBuff(&metaWriter, metaFile, numBits);
+		// Move on to the piece we read ahead
+		buffer = nextBuffer;
+		validRead = nextRead;
+		edge = nextEdge;
+		skipKeys = extraKeys;
+	}
 
-	for (unsigned long i = 0; i < counts.n; ++i)
-		pushToWriteBuff(&metaWriter, counts.data[i] << (64 - numBits));
+	if (writeIndex(outputFile, index, numChunks, offset) ||
+	    fflush(outputFile)) {
+		fprintf(stderr, "Error writing the chunk index\n");
+		return -1;
+	}
 
-	closeWriteBuff(&metaWriter);
+	fprintf(msg, "Chunks: %" PRIu64 ", runs: %" PRIu64 "\n", numChunks,
+		totalRuns);
 
 	struct timeval elapsedTime;
 
 	gettimeofday(&tvEnd, 0);
 	subtractTime(&tvStart, &tvEnd, &elapsedTime);
 
-	printf("Elapsed time: %ld.%ld06\n", elapsedTime.tv_sec,
-	       elapsedTime.tv_usec);
+	fprintf(msg, "Elapsed time: %ld.%ld06\n", elapsedTime.tv_sec,
+		elapsedTime.tv_usec);
 
 	// Close the files after we use them
-	fclose(inputFile);
-	fclose(dataFile);
-	fclose(metaFile);
+	if (in.map)
+		munmap(in.map, in.size);
+	if (in.stream)
+		fclose(in.stream);
+	else
+		close(inputFd);
+	fclose(outputFile);
 
 	// Free up any allocations we made
-	free(dataFileName);
-	free(metaFileName);
-	free(buffer);
-	free(counts.data);
+	free(outputFileName);
+	free(in.buffers[0]);
+	free(in.buffers[1]);
+	free(index);
 
 	return 0;
 }
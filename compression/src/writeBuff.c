@@ -2,29 +2,86 @@
 
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "../include/common.h"
 #include "../include/writeBuff.h"
 
-void initWriteBuff(struct writeBuff *wBuff, FILE *file, unsigned int keySize)
+// Makes room for at least need more bytes in the block: a file sink writes
+// the block out, an in-memory sink doubles it
+static int makeRoom(struct writeBuff *wBuff, size_t need)
+{
+	if (wBuff->file) {
+		if (wBuff->blockUsed &&
+		    fwrite(wBuff->block, 1, wBuff->blockUsed, wBuff->file) !=
+			    wBuff->blockUsed)
+			wBuff->err = 1;
+		wBuff->blockUsed = 0;
+		return wBuff->err ? -1 : 0;
+	}
+
+	size_t newSize = wBuff->blockSize * 2;
+
+	while (newSize < wBuff->blockUsed + need)
+		newSize *= 2;
+
+	unsigned char *newBlock = realloc(wBuff->block, newSize);
+
+	if (!newBlock) {
+		wBuff->err = 1;
+		return -1;
+	}
+
+	wBuff->block = newBlock;
+	wBuff->blockSize = newSize;
+	return 0;
+}
+
+// Stores a full 64-bit word big-endian at the end of the block
+static inline void storeWord(struct writeBuff *wBuff, uint64_t word)
+{
+	if (wBuff->blockUsed + 8 > wBuff->blockSize && makeRoom(wBuff, 8))
+		return;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	memcpy(wBuff->block + wBuff->blockUsed, &word, 8);
+	wBuff->blockUsed += 8;
+}
+
+int initWriteBuff(struct writeBuff *wBuff, FILE *file, unsigned int keySize,
+		  size_t blockSize)
 {
 	wBuff->file = file;
 	wBuff->keySize = keySize;
 	wBuff->currBit = 0;
 	wBuff->buff = 0;
+	wBuff->err = 0;
+
+	// Whole words always fit in the block
+	wBuff->blockSize = blockSize ? (blockSize + 7) & ~(size_t)7 :
+				       WRITE_BUFF_BLOCK;
+	wBuff->blockUsed = 0;
+	wBuff->block = malloc(wBuff->blockSize);
+
+	return wBuff->block ? 0 : -1;
 }
 
-void pushToWriteBuff(struct writeBuff *wBuff, uint64_t toWrite)
+// Appends the numBits high bits of toWrite, the rest of it being zero
+static inline void pushLeftAligned(struct writeBuff *wBuff, uint64_t toWrite,
+				   unsigned int numBits)
 {
 	// If we can fit something into our mini-buffer, then do so.
-	if (wBuff->currBit + wBuff->keySize <= 64) {
+	if (wBuff->currBit + numBits <= 64) {
 		// Shift the toWrite elements into place
 		// Then add the current buffer and toWrite
 		toWrite = toWrite >> wBuff->currBit;
 
 		wBuff->buff += toWrite;
 
-		wBuff->currBit += wBuff->keySize;
+		wBuff->currBit += numBits;
 	}
 
 	// Otherwise, we need to fill it as much as
@@ -36,28 +93,60 @@ void pushToWriteBuff(struct writeBuff *wBuff, uint64_t toWrite)
 		if (avalBits != 0)
 			wBuff->buff += (toWrite >> (wBuff->currBit));
 
-		// Write to file here
-		write64ToFile(wBuff->file, (wBuff->buff));
+		// Store the full word in the block
+		storeWord(wBuff, wBuff->buff);
 
 		// Reset the buff
 		wBuff->buff = 0;
 
 		wBuff->buff += (toWrite << avalBits);
 
-		wBuff->currBit = wBuff->keySize - avalBits;
+		wBuff->currBit = numBits - avalBits;
 	}
 }
 
+void pushToWriteBuff(struct writeBuff *wBuff, uint64_t toWrite)
+{
+	pushLeftAligned(wBuff, toWrite, wBuff->keySize);
+}
+
+void pushBitsToWriteBuff(struct writeBuff *wBuff, uint64_t toWrite,
+			 unsigned int numBits)
+{
+	if (numBits > 0)
+		pushLeftAligned(wBuff, toWrite << (64 - numBits), numBits);
+}
+
+void alignWriteBuff(struct writeBuff *wBuff)
+{
+	wBuff->currBit = (wBuff->currBit + 7) & ~7U;
+}
+
 // Write the last of what we have to the file
-void closeWriteBuff(struct writeBuff *wBuff)
+int closeWriteBuff(struct writeBuff *wBuff)
 {
 	// We want to take all the bytes we have and write them
 	unsigned int numBytesToWrite =
 		(wBuff->currBit / 8) + ((wBuff->currBit % 8) ? 1 : 0);
 
-	for (int i = 1; i <= numBytesToWrite; ++i) {
-		unsigned char chunk = (wBuff->buff >> (64 - i * 8)) & 0xFF;
+	if (wBuff->blockUsed + numBytesToWrite > wBuff->blockSize)
+		makeRoom(wBuff, numBytesToWrite);
+
+	if (!wBuff->err) {
+		for (unsigned int i = 1; i <= numBytesToWrite; ++i)
+			wBuff->block[wBuff->blockUsed++] =
+				(wBuff->buff >> (64 - i * 8)) & 0xFF;
+	}
+
+	wBuff->currBit = 0;
+	wBuff->buff = 0;
 
-		fputc(chunk, wBuff->file);
+	// An in-memory sink hands the block over to the caller
+	if (wBuff->file) {
+		makeRoom(wBuff, 0);
+		free(wBuff->block);
+		wBuff->block = NULL;
 	}
+
+	return wBuff->err ? -1 : 0;
 }
@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: GPL-3.0 */
+
+/*
+ * Reader for the MSB-first bit streams of an archive chunk.
+ *
+ * Bits are served from a 64-bit register topped up with one unaligned load
+ * per refill, so a read costs a few shifts instead of a stdio call per byte.
+ * The functions are inline since the decoder calls them for every run.
+ */
+
+#ifndef BIT_READER_H
+#define BIT_READER_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief State of a bit stream being read.
+ */
+struct bitReader {
+	const unsigned char *buff;      /**< Bytes of the stream. */
+	uint64_t size;                  /**< Size of the stream in bytes. */
+	uint64_t nextByte;              /**< Next byte to load into bitBuf. */
+	uint64_t bitBuf;                /**< Next bits of the stream, MSB first. */
+	unsigned int bitCount;          /**< Number of valid bits in bitBuf. */
+};
+
+// Loads 8 bytes as a big-endian word with a single unaligned load
+static inline uint64_t loadBigEndian64(const unsigned char *ptr)
+{
+	uint64_t word;
+
+	memcpy(&word, ptr, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+// Tops bitBuf up to at least 56 valid bits. Close to the end of the stream
+// the load is done byte by byte, with zeros past the end.
+static inline void refillBits(struct bitReader *reader)
+{
+	uint64_t word;
+
+	if (reader->nextByte + 8 <= reader->size) {
+		word = loadBigEndian64(reader->buff + reader->nextByte);
+	} else {
+		unsigned char tail[8] = { 0 };
+
+		if (reader->nextByte < reader->size)
+			memcpy(tail, reader->buff + reader->nextByte,
+			       reader->size - reader->nextByte);
+		word = loadBigEndian64(tail);
+	}
+
+	reader->bitBuf |= word >> reader->bitCount;
+	reader->nextByte += (63 - reader->bitCount) >> 3;
+	reader->bitCount |= 56;
+}
+
+/**
+ * @brief Initializes a bitReader over a stream.
+ *
+ * @param reader Pointer to the bitReader structure to initialize.
+ * @param buff Bytes of the stream.
+ * @param size Size of the stream in bytes.
+ */
+static inline void initBitReader(struct bitReader *reader,
+				 const unsigned char *buff, uint64_t size)
+{
+	reader->buff = buff;
+	reader->size = size;
+	reader->nextByte = 0;
+	reader->bitBuf = 0;
+	reader->bitCount = 0;
+}
+
+/**
+ * @brief Gets the number of bits read so far.
+ *
+ * @param reader Pointer to the bitReader structure.
+ * @return Bit offset in the stream of the next bit to be read.
+ */
+static inline uint64_t bitsRead(const struct bitReader *reader)
+{
+	return reader->nextByte * 8 - reader->bitCount;
+}
+
+/**
+ * @brief Reads the next bits of the stream.
+ *
+ * Reading past the end of the stream gives zeros.
+ *
+ * @param reader Pointer to the bitReader structure.
+ * @param n Number of bits to read, 1 <= n <= 64.
+ * @return The bits read, right-aligned.
+ */
+static inline uint64_t readBits(struct bitReader *reader, unsigned int n)
+{
+	uint64_t ret;
+
+	if (n > 56) {
+		// Too wide for one refill, take it in two halves
+		ret = readBits(reader, 32) << (n - 32);
+		return ret | readBits(reader, n - 32);
+	}
+
+	if (reader->bitCount < n)
+		refillBits(reader);
+
+	ret = reader->bitBuf >> (64 - n);
+	reader->bitBuf <<= n;
+	reader->bitCount -= n;
+	return ret;
+}
+
+/**
+ * @brief Moves the reader to any bit of the stream.
+ *
+ * @param reader Pointer to the bitReader structure.
+ * @param bit Bit offset in the stream of the next bit to read.
+ */
+static inline void seekBits(struct bitReader *reader, uint64_t bit)
+{
+	reader->nextByte = bit / 8;
+	reader->bitBuf = 0;
+	reader->bitCount = 0;
+
+	if (bit % 8)
+		readBits(reader, bit % 8);
+}
+
+#endif // BIT_READER_H
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-3.0 */
+
+/*
+ * Writer packing decoded keys MSB-first into an output buffer.
+ *
+ * Bits gather in a 64-bit register and only whole words are stored, with a
+ * single big-endian store each. The functions are inline since the decoder
+ * calls them for every key it writes.
+ */
+
+#ifndef BIT_WRITER_H
+#define BIT_WRITER_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief State of an output buffer being filled.
+ */
+struct bitWriter {
+	unsigned char *out;             /**< Output buffer. */
+	uint64_t pos;                   /**< Number of bytes stored in out. */
+	uint64_t acc;                   /**< Bits not stored yet, MSB first. */
+	unsigned int accBits;           /**< Number of valid bits in acc. */
+};
+
+// Stores a word big-endian with a single unaligned store
+static inline void storeBigEndian64(unsigned char *ptr, uint64_t word)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	memcpy(ptr, &word, 8);
+}
+
+/**
+ * @brief Initializes a bitWriter over a buffer.
+ *
+ * @param writer Pointer to the bitWriter structure to initialize.
+ * @param out Output buffer, with room for 8 bytes past the last bit written.
+ */
+static inline void initBitWriter(struct bitWriter *writer, unsigned char *out)
+{
+	writer->out = out;
+	writer->pos = 0;
+	writer->acc = 0;
+	writer->accBits = 0;
+}
+
+/**
+ * @brief Appends bits to the output.
+ *
+ * @param writer Pointer to the bitWriter structure.
+ * @param value Bits to write, right-aligned, nothing set above the n lowest.
+ * @param n Number of bits to write, 1 <= n <= 64.
+ */
+static inline void putBits(struct bitWriter *writer, uint64_t value,
+			   unsigned int n)
+{
+	unsigned int room = 64 - writer->accBits;
+
+	if (n < room) {
+		writer->acc |= value << (room - n);
+		writer->accBits += n;
+		return;
+	}
+
+	// Fill the register up, store it and keep what did not fit
+	writer->acc |= value >> (n - room);
+	storeBigEndian64(writer->out + writer->pos, writer->acc);
+	writer->pos += 8;
+
+	writer->accBits = n - room;
+	writer->acc = writer->accBits ? value << (64 - writer->accBits) : 0;
+}
+
+/**
+ * @brief Stores the bits left in the register, padding the last byte with zeros.
+ *
+ * @param writer Pointer to the bitWriter structure.
+ */
+static inline void flushBits(struct bitWriter *writer)
+{
+	for (unsigned int i = 0; i < writer->accBits; i += 8)
+		writer->out[writer->pos++] = writer->acc >> (56 - i);
+
+	writer->acc = 0;
+	writer->accBits = 0;
+}
+
+#endif // BIT_WRITER_H
@@ -11,30 +11,6 @@
 // Macro to find the minimum of two values
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 
-/**
- * @brief Function to read a variable-length integer from a file stream.
- *
- * @param stream The file stream to read from.
- * @param used A pointer to a flag indicating if the current buffer 'cur' is used.
- * @param cur A pointer to the current byte buffer.
- * @param size The maximum size of the variable-length integer in bytes.
- * @return uint64_t The variable-length integer read from the stream.
- */
-uint64_t get(FILE *stream, unsigned char *used, unsigned char *cur,
-	     unsigned char size);
-
-/**
- * @brief Function to write a variable-length integer to a file stream.
- *
- * @param stream The file stream to write to.
- * @param toPut The integer to write.
- * @param used A pointer to a flag indicating if the current buffer 'cur' is used.
- * @param cur A pointer to the current byte buffer.
- * @param size The maximum size of the variable-length integer in bytes.
- */
-void put(FILE *stream, uint64_t toPut, unsigned char *used, unsigned char *cur,
-	 unsigned char size);
-
 /**
  * @brief Function to calculate the time difference between two timeval structs.
  *
@@ -45,4 +21,16 @@ void put(FILE *stream, uint64_t toPut, unsigned char *used, unsigned char *cur,
 void subtractTime(struct timeval *start, struct timeval *end,
 		  struct timeval *elapsed);
 
+/**
+ * @brief Takes a "--threads N" option out of the command line arguments.
+ *
+ * The option may come anywhere, the other arguments are moved down in
+ * argv and argc is updated to count them only.
+ *
+ * @param argc Pointer to the number of arguments.
+ * @param argv The arguments.
+ * @return N, 1 without the option, -1 if N is not in [1, 1024].
+ */
+int takeThreadsOption(int *argc, char **argv);
+
 #endif // COMMON_H
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: GPL-3.0 */
+
+/*
+ * Reading side of the archive layout written by the compressors: a header,
+ * a sequence of independently decodable chunks and a trailing index giving
+ * the offset, number of runs and decompressed size of every chunk.
+ */
+
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CONTAINER_MAGIC "RLEC"
+#define CONTAINER_VERSION 2
+#define TRAILER_MAGIC "RLEINDEX"
+
+#define CONTAINER_HEADER_SIZE 8
+#define CHUNK_HEADER_SIZE 32
+#define INDEX_ENTRY_SIZE 24
+#define TRAILER_SIZE 24
+
+// Largest decompressed chunk a reader accepts. The compressors cut pieces
+// of DEFAULT_CHUNK_SIZE bytes and a chunk holds at most the run stitched
+// from the next piece on top of its own, so anything bigger is corrupted.
+#ifndef MAX_CHUNK_SIZE
+#define MAX_CHUNK_SIZE (1UL << 30)
+#endif
+
+// Coding of the count stream of a chunk: every run length at runLen bits,
+// or blocks of COUNT_BLOCK run lengths each with its own width. Version 1
+// archives only have the first.
+#define COUNTS_FIXED 0
+#define COUNTS_BLOCKED 1
+#define COUNT_BLOCK 128
+
+// Most keys the palette of a chunk may hold
+#define PALETTE_MAX 4096
+
+// Entropy flags of a chunk, set for each stream coded with the Huffman
+// stage, and the longest code and size of the header of such a stream
+#define ENTROPY_META 1
+#define ENTROPY_DATA 2
+#define HUFFMAN_MAX_BITS 12
+#define HUFFMAN_HEADER_SIZE (8 + 256 / 2)
+
+/**
+ * @brief Index entry describing one chunk of the archive.
+ */
+struct chunkInfo {
+	uint64_t offset;        /**< Offset of the chunk from the start of the archive. */
+	uint64_t numRuns;       /**< Number of runs stored in the chunk. */
+	uint64_t rawSize;       /**< Size in bytes of the chunk once decompressed. */
+};
+
+/**
+ * @brief Header of a chunk, telling how to decode its two streams.
+ */
+struct chunkHeader {
+	unsigned char keyLen;   /**< Bit length of a key. */
+	unsigned char runLen;   /**< Bit length of a run. */
+	unsigned char countCoding; /**< Coding of the count stream. */
+	unsigned char entropy;  /**< Which streams are Huffman coded. */
+	unsigned int paletteSize; /**< Number of keys in the palette, 0 for none. */
+	uint64_t numRuns;       /**< Number of runs in the chunk. */
+	uint64_t metaOffset;    /**< Archive offset of the count stream. */
+	uint64_t metaBytes;     /**< Size of the count stream in bytes. */
+	uint64_t dataOffset;    /**< Archive offset of the key stream. */
+	uint64_t dataBytes;     /**< Size of the key stream in bytes. */
+};
+
+/**
+ * @brief An archive opened for decompression.
+ */
+struct archive {
+	FILE *file;                     /**< The archive itself. */
+	unsigned char *map;             /**< The whole archive mapped in memory, NULL if it could not be. */
+	uint64_t size;                  /**< Size of the archive in bytes. */
+	unsigned char keyLen;           /**< Key size given in the archive header. */
+	uint64_t numChunks;             /**< Number of chunks in the archive. */
+	struct chunkInfo *index;        /**< Index entry of every chunk. */
+};
+
+/**
+ * @brief Opens an archive and loads its chunk index.
+ *
+ * The archive is also mapped in memory when possible, so the streams of a
+ * chunk can be decoded in place.
+ *
+ * @param ar Archive to fill in.
+ * @param name Name of the archive file.
+ * @return 0 on success, -1 if the file is missing or not an archive.
+ */
+int openArchive(struct archive *ar, const char *name);
+
+/**
+ * @brief Reads the header of a chunk.
+ *
+ * @param ar Opened archive.
+ * @param idx Index of the chunk.
+ * @param hdr Header to fill in.
+ * @return 0 on success, -1 on error or if the chunk does not fit in the archive or its index entry.
+ */
+int readChunkHeader(struct archive *ar, uint64_t idx, struct chunkHeader *hdr);
+
+/**
+ * @brief Closes an archive and frees its index.
+ *
+ * @param ar Archive to close.
+ */
+void closeArchive(struct archive *ar);
+
+#endif // CONTAINER_H
@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: GPL-3.0 */
+
+/*
+ * Reader for the count stream of an archive chunk.
+ *
+ * Fixed-width counts are read straight from the bit stream. Blocked counts
+ * are unpacked a whole block at a time: the low bits of all the values in
+ * one tight loop, then the few exceptions patched in. The functions are
+ * inline since the decoder calls them for every run.
+ */
+
+#ifndef COUNT_READER_H
+#define COUNT_READER_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bitReader.h"
+#include "container.h"
+
+/**
+ * @brief State of a count stream being read.
+ */
+struct countReader {
+	struct bitReader bits;          /**< The count stream. */
+	unsigned char coding;           /**< COUNTS_FIXED or COUNTS_BLOCKED. */
+	unsigned char runLen;           /**< Width of a fixed-width count. */
+	uint64_t blockBit;              /**< Bit offset of the block unpacked in values. */
+	unsigned int next;              /**< Next value of the block to hand out. */
+	uint64_t values[COUNT_BLOCK];   /**< The unpacked block. */
+};
+
+/**
+ * @brief Position in a count stream, to get back to later.
+ */
+struct countPos {
+	uint64_t bit;           /**< Bit offset of the value, or of its block. */
+	unsigned int idx;       /**< Index of the value in its block. */
+};
+
+/**
+ * @brief Initializes a countReader over a count stream.
+ *
+ * @param reader Pointer to the countReader structure to initialize.
+ * @param buff Bytes of the stream.
+ * @param size Size of the stream in bytes.
+ * @param coding Coding of the stream, COUNTS_FIXED or COUNTS_BLOCKED.
+ * @param runLen Width of a count for COUNTS_FIXED.
+ */
+static inline void initCountReader(struct countReader *reader,
+				   const unsigned char *buff, uint64_t size,
+				   unsigned char coding, unsigned char runLen)
+{
+	initBitReader(&reader->bits, buff, size);
+	reader->coding = coding;
+	reader->runLen = runLen;
+	reader->blockBit = 0;
+	reader->next = COUNT_BLOCK;
+}
+
+// Unpacks the block starting at the current position. Widths are clamped so
+// that a corrupted stream gives wrong values and nothing worse.
+static inline void unpackCountBlock(struct countReader *reader)
+{
+	struct bitReader *bits = &reader->bits;
+	unsigned int pos[COUNT_BLOCK];
+	uint64_t high[COUNT_BLOCK];
+
+	reader->blockBit = bitsRead(bits);
+
+	unsigned int width = readBits(bits, 8);
+	unsigned int numExc = readBits(bits, 8);
+	unsigned int excWidth = readBits(bits, 8);
+
+	if (width > 64)
+		width = 64;
+	if (numExc > COUNT_BLOCK)
+		numExc = COUNT_BLOCK;
+	if (excWidth > 64)
+		excWidth = 64;
+
+	for (unsigned int e = 0; e < numExc; ++e) {
+		pos[e] = readBits(bits, 7);
+		high[e] = excWidth ? readBits(bits, excWidth) : 0;
+	}
+
+	if (width == 0)
+		memset(reader->values, 0, sizeof(reader->values));
+	for (unsigned int i = 0; width && i < COUNT_BLOCK; ++i)
+		reader->values[i] = readBits(bits, width);
+
+	for (unsigned int e = 0; width < 64 && e < numExc; ++e)
+		reader->values[pos[e]] |= high[e] << width;
+
+	// Blocks start on a byte boundary
+	if (bitsRead(bits) % 8)
+		readBits(bits, 8 - bitsRead(bits) % 8);
+
+	reader->next = 0;
+}
+
+/**
+ * @brief Reads the next count.
+ *
+ * @param reader Pointer to the countReader structure.
+ * @return The count, 0 past the end of the stream.
+ */
+static inline uint64_t readCount(struct countReader *reader)
+{
+	if (reader->coding == COUNTS_FIXED)
+		return readBits(&reader->bits, reader->runLen);
+
+	if (reader->next == COUNT_BLOCK)
+		unpackCountBlock(reader);
+
+	return reader->values[reader->next++];
+}
+
+/**
+ * @brief Gets the position of the next count to be read.
+ *
+ * @param reader Pointer to the countReader structure.
+ * @return Position to give to seekCounts().
+ */
+static inline struct countPos countsRead(const struct countReader *reader)
+{
+	struct countPos pos = { bitsRead(&reader->bits), 0 };
+
+	// Unless the block is used up, come back to the block itself
+	if (reader->coding == COUNTS_BLOCKED) {
+		pos.idx = reader->next;
+		if (reader->next < COUNT_BLOCK)
+			pos.bit = reader->blockBit;
+	}
+
+	return pos;
+}
+
+/**
+ * @brief Moves the reader back or forth to a position it was at.
+ *
+ * @param reader Pointer to the countReader structure.
+ * @param pos Position returned by countsRead().
+ */
+static inline void seekCounts(struct countReader *reader, struct countPos pos)
+{
+	seekBits(&reader->bits, pos.bit);
+	reader->next = COUNT_BLOCK;
+
+	if (reader->coding == COUNTS_BLOCKED && pos.idx < COUNT_BLOCK) {
+		unpackCountBlock(reader);
+		reader->next = pos.idx;
+	}
+}
+
+#endif // COUNT_READER_H
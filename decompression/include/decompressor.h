@@ -7,47 +7,47 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "bitReader.h"
+#include "container.h"
+#include "countReader.h"
+
 /**
- * @brief Retrieves metadata from the meta and data files.
+ * @brief Decompresses one chunk of an archive into a buffer.
+ *
+ * This function reads the header of the chunk, sets up readers over its
+ * count and key streams, straight from the archive mapping when there is one,
+ * and decodes all of its runs.
  *
- * This function reads the initial bytes from the meta and data files to
- * determine the bit lengths of keys and the number of runs.
+ * With more than one thread, a pass over the count stream first sums up the
+ * run lengths, then every thread decodes its own byte-aligned share of the
+ * output. Chunks too small to be worth it are decoded by the caller alone.
  *
- * @param meta File pointer to the meta file.
- * @param data File pointer to the data file.
- * @param mUsed Pointer to a flag indicating if the current byte in meta is used.
- * @param dUsed Pointer to a flag indicating if the current byte in data is used.
- * @param mCur Pointer to the current byte buffer for meta.
- * @param dCur Pointer to the current byte buffer for data.
- * @param runLen Pointer to store the bit length of the run.
- * @param keyLen Pointer to store the bit length of the key.
- * @param numRuns Pointer to store the number of runs.
+ * @param ar Opened archive.
+ * @param idx Index of the chunk to decompress.
+ * @param outBuf Output buffer of at least the chunk's rawSize + 8 bytes.
+ * @param numThreads Number of threads decoding the chunk, the caller included.
+ * @return 0 on success, -1 if the chunk could not be read or is corrupted.
  */
-void getMetaData(FILE *meta, FILE *data, unsigned char *mUsed,
-		 unsigned char *dUsed, unsigned char *mCur, unsigned char *dCur,
-		 unsigned char *runLen, unsigned char *keyLen,
-		 uint64_t *numRuns);
+int decompressChunk(struct archive *ar, uint64_t idx, unsigned char *outBuf,
+		    int numThreads);
 
 /**
  * @brief Decompresses the data using the provided metadata.
  *
- * This function iterates through the meta file to determine run lengths and
- * the data file to extract keys. It writes the decompressed data into the
- * output file.
+ * This function iterates through the count stream to determine run lengths
+ * and the key stream to extract keys. It writes the decompressed data into
+ * the output buffer.
  *
- * @param meta File pointer to the meta file.
- * @param data File pointer to the data file.
- * @param out File pointer to the output file.
- * @param mUsed Pointer to a flag indicating if the current byte in meta is used.
- * @param dUsed Pointer to a flag indicating if the current byte in data is used.
- * @param mCur Pointer to the current byte buffer for meta.
- * @param dCur Pointer to the current byte buffer for data.
- * @param runLen Bit length of the run.
+ * @param meta Reader over the count stream.
+ * @param data Reader over the key stream.
+ * @param outBuf Output buffer to store the decompressed data.
  * @param keyLen Bit length of the key.
  * @param numRuns Number of runs to process.
+ * @param maxKeys Number of keys the runs should hold, outBuf has room for them.
+ * @return 0 on success, -1 if the runs do not hold exactly maxKeys keys.
  */
-void decompress(FILE *meta, FILE *data, FILE *out, unsigned char *mUsed,
-		unsigned char *dUsed, unsigned char *mCur, unsigned char *dCur,
-		unsigned char runLen, unsigned char keyLen, uint64_t numRuns);
+int decompress(struct countReader *meta, struct bitReader *data,
+	       unsigned char *outBuf, unsigned char keyLen, uint64_t numRuns,
+	       uint64_t maxKeys);
 
 #endif // DECOMPRESSOR_H
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: GPL-3.0 */
+
+/*
+ * Decoder for the Huffman stage the compressors can run the streams of a
+ * chunk through.
+ *
+ * Codes are at most HUFFMAN_MAX_BITS long, so a table indexed by the next
+ * HUFFMAN_MAX_BITS bits of the stream resolves the next code, and the one
+ * after it too whenever both fit, in a single lookup.
+ */
+
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <inttypes.h>
+#include <stdint.h>
+
+/**
+ * @brief Decodes a Huffman coded stream.
+ *
+ * @param in Bytes of the coded stream.
+ * @param size Size of the coded stream in bytes.
+ * @param out Receives the decoded stream, to be freed by the caller.
+ * @param outSize Receives the size of the decoded stream.
+ * @return 0 on success, -1 if the coded stream is corrupted or out of memory.
+ */
+int huffmanDecode(const unsigned char *in, uint64_t size, unsigned char **out,
+		  uint64_t *outSize);
+
+#endif // HUFFMAN_H
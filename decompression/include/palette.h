@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: GPL-3.0 */
+
+/*
+ * Expansion of the key stream of a chunk written with a palette.
+ *
+ * Such a stream starts with the keys of the palette, then gives every key
+ * as an index into it. The indices are looked up in a table of PALETTE_MAX
+ * keys, so that no index read from a corrupted stream can fall outside it.
+ */
+
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <inttypes.h>
+#include <stdint.h>
+
+/**
+ * @brief Turns a key stream written with a palette back into plain keys.
+ *
+ * @param in Bytes of the key stream.
+ * @param size Size of the key stream in bytes.
+ * @param paletteSize Number of keys in the palette, 1 <= paletteSize <= PALETTE_MAX.
+ * @param keyLen Bit length of a key.
+ * @param maxKeys Most keys the chunk may hold, no more are expanded.
+ * @param out Receives the plain key stream, to be freed by the caller.
+ * @param outSize Receives the size of the plain key stream.
+ * @return 0 on success, -1 if the palette does not fit in the stream or out of memory.
+ */
+int paletteDecode(const unsigned char *in, uint64_t size,
+		  unsigned int paletteSize, unsigned int keyLen,
+		  uint64_t maxKeys, unsigned char **out, uint64_t *outSize);
+
+#endif // PALETTE_H
@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: GPL-3.0
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../include/container.h"
+
+// Reads a big-endian 64-bit integer from the 8 bytes at in
+static uint64_t get64(const unsigned char *in)
+{
+	uint64_t ret = 0;
+
+	for (int i = 0; i < 8; ++i)
+		ret = (ret << 8) | in[i];
+
+	return ret;
+}
+
+// Checks that the chunks follow one another between the header and the
+// index, and that none claims more than it could decompress to
+static int checkIndex(struct archive *ar, uint64_t indexOffset)
+{
+	for (uint64_t i = 0; i < ar->numChunks; ++i) {
+		struct chunkInfo *info = &ar->index[i];
+		uint64_t end = i + 1 < ar->numChunks ? ar->index[i + 1].offset :
+						       indexOffset;
+
+		if (info->offset < (i ? ar->index[i - 1].offset +
+						CHUNK_HEADER_SIZE :
+					CONTAINER_HEADER_SIZE) ||
+		    info->offset > end || end - info->offset < CHUNK_HEADER_SIZE)
+			return -1;
+
+		// Every run takes at least a bit of each stream, which the
+		// Huffman stage never codes in less than an eighth of one
+		if (info->rawSize > MAX_CHUNK_SIZE ||
+		    (info->rawSize > 0) != (info->numRuns > 0) ||
+		    info->numRuns > (end - info->offset) * 64)
+			return -1;
+	}
+
+	return 0;
+}
+
+int openArchive(struct archive *ar, const char *name)
+{
+	unsigned char header[CONTAINER_HEADER_SIZE];
+	unsigned char trailer[TRAILER_SIZE];
+	unsigned char *raw;
+	uint64_t indexOffset;
+
+	struct stat st;
+
+	ar->index = NULL;
+	ar->map = NULL;
+	ar->file = fopen(name, "rb");
+	if (!ar->file)
+		return -1;
+
+	if (fstat(fileno(ar->file), &st))
+		goto fail;
+	ar->size = st.st_size;
+
+	// Check the header at the start of the file
+	if (fread(header, 1, CONTAINER_HEADER_SIZE, ar->file) !=
+		    CONTAINER_HEADER_SIZE ||
+	    memcmp(header, CONTAINER_MAGIC, 4) ||
+	    header[4] < 1 || header[4] > CONTAINER_VERSION)
+		goto fail;
+
+	ar->keyLen = header[5];
+
+	// The trailer at the end of the file tells where the index is
+	if (fseek(ar->file, -TRAILER_SIZE, SEEK_END) ||
+	    fread(trailer, 1, TRAILER_SIZE, ar->file) != TRAILER_SIZE ||
+	    memcmp(trailer + 16, TRAILER_MAGIC, 8))
+		goto fail;
+
+	indexOffset = get64(trailer);
+	ar->numChunks = get64(trailer + 8);
+
+	// The index has to fill the space between the chunks and the trailer
+	if (ar->numChunks > ar->size / INDEX_ENTRY_SIZE ||
+	    indexOffset < CONTAINER_HEADER_SIZE || indexOffset > ar->size ||
+	    indexOffset + ar->numChunks * INDEX_ENTRY_SIZE + TRAILER_SIZE !=
+		    ar->size)
+		goto fail;
+
+	raw = malloc(ar->numChunks * INDEX_ENTRY_SIZE + 1);
+	ar->index = malloc(sizeof(*ar->index) * ar->numChunks + 1);
+	if (!raw || !ar->index) {
+		free(raw);
+		goto fail;
+	}
+
+	if (fseek(ar->file, indexOffset, SEEK_SET) ||
+	    fread(raw, INDEX_ENTRY_SIZE, ar->numChunks, ar->file) !=
+		    ar->numChunks) {
+		free(raw);
+		goto fail;
+	}
+
+	for (uint64_t i = 0; i < ar->numChunks; ++i) {
+		unsigned char *entry = raw + i * INDEX_ENTRY_SIZE;
+
+		ar->index[i].offset = get64(entry);
+		ar->index[i].numRuns = get64(entry + 8);
+		ar->index[i].rawSize = get64(entry + 16);
+	}
+
+	free(raw);
+
+	if (checkIndex(ar, indexOffset))
+		goto fail;
+
+	// Chunks are decoded straight from the mapping, if the archive cannot
+	// be mapped they are read from the file instead
+	void *map = mmap(NULL, ar->size, PROT_READ, MAP_PRIVATE,
+			 fileno(ar->file), 0);
+
+	if (map != MAP_FAILED) {
+		madvise(map, ar->size, MADV_SEQUENTIAL);
+		ar->map = map;
+	}
+
+	return 0;
+
+fail:
+	closeArchive(ar);
+	return -1;
+}
+
+int readChunkHeader(struct archive *ar, uint64_t idx, struct chunkHeader *hdr)
+{
+	unsigned char raw[CHUNK_HEADER_SIZE];
+	uint64_t offset = ar->index[idx].offset;
+
+	if (offset > ar->size || ar->size - offset < CHUNK_HEADER_SIZE)
+		return -1;
+
+	if (ar->map)
+		memcpy(raw, ar->map + offset, CHUNK_HEADER_SIZE);
+	else if (fseek(ar->file, offset, SEEK_SET) ||
+		 fread(raw, 1, CHUNK_HEADER_SIZE, ar->file) !=
+			 CHUNK_HEADER_SIZE)
+		return -1;
+
+	hdr->keyLen = raw[0];
+	hdr->runLen = raw[1];
+	hdr->countCoding = raw[2];
+	hdr->entropy = raw[3];
+	hdr->paletteSize = (unsigned int)raw[4] << 8 | raw[5];
+	hdr->numRuns = get64(raw + 8);
+	hdr->metaBytes = get64(raw + 16);
+	hdr->dataBytes = get64(raw + 24);
+	hdr->metaOffset = offset + CHUNK_HEADER_SIZE;
+	hdr->dataOffset = hdr->metaOffset + hdr->metaBytes;
+
+	// Every chunk gives its own key size, archives compressed in
+	// adaptive mode have none in their header
+	if (hdr->keyLen < 1 || hdr->keyLen > 64)
+		return -1;
+
+	// Fixed-width counts need a width a reader can take
+	if (hdr->countCoding > COUNTS_BLOCKED ||
+	    hdr->entropy > (ENTROPY_META | ENTROPY_DATA) ||
+	    hdr->paletteSize > PALETTE_MAX ||
+	    (hdr->countCoding == COUNTS_FIXED &&
+	     (hdr->runLen < 1 || hdr->runLen > 64)))
+		return -1;
+
+	// The header has to agree with the index, and every run holds at
+	// least one key of the chunk
+	if (hdr->numRuns != ar->index[idx].numRuns ||
+	    hdr->numRuns > ar->index[idx].rawSize * 8 / hdr->keyLen + 1)
+		return -1;
+
+	// Both streams have to lie within the archive
+	if (hdr->metaBytes > ar->size || hdr->dataBytes > ar->size ||
+	    hdr->dataOffset + hdr->dataBytes > ar->size)
+		return -1;
+
+	return 0;
+}
+
+void closeArchive(struct archive *ar)
+{
+	if (ar->map)
+		munmap(ar->map, ar->size);
+	if (ar->file)
+		fclose(ar->file);
+
+	free(ar->index);
+	ar->file = NULL;
+	ar->map = NULL;
+	ar->index = NULL;
+}
@@ -1,62 +1,596 @@
 // SPDX-License-Identifier: GPL-3.0
 
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "../include/bitReader.h"
+#include "../include/bitWriter.h"
 #include "../include/common.h"
+#include "../include/container.h"
+#include "../include/countReader.h"
 #include "../include/decompressor.h"
+#include "../include/huffman.h"
+#include "../include/palette.h"
+
+// Runs of byte-aligned keys covering at least this many bytes are filled in
+// bulk rather than key by key
+#define FILL_MIN_BYTES 32
+
+// Runs of other keys covering at least this many bits are filled a word at
+// a time
+#define FILL_MIN_BITS 256
+
+// Escaped series of unique keys covering at least this many bits are copied
+// in bulk rather than key by key
+#define COPY_MIN_BITS 256
+
+// Size the key pattern is doubled up to before being copied over and over
+#define FILL_BLOCK 4096
+
+// Runs longer than this are written with non-temporal stores, so that they
+// do not push the rest of the output out of the cache
+#ifndef STREAM_FILL_BYTES
+#define STREAM_FILL_BYTES (4UL << 20)
+#endif
+
+// Chunks are only split between threads in parts of at least this many
+// output bytes
+#ifndef THREAD_MIN_BYTES
+#define THREAD_MIN_BYTES (1UL << 20)
+#endif
+
+// Runs between two checkpoints of the prefix sums threads start from
+#define CHECKPOINT_RUNS 1024
+
+/*
+ * Prefix sums over the count stream, taken every CHECKPOINT_RUNS runs. A run
+ * is a proper run or an escaped series of unique keys.
+ */
+struct checkpoint {
+	uint64_t run;           /**< Runs before the checkpoint. */
+	struct countPos metaPos; /**< Position of the run in the count stream. */
+	uint64_t dataBit;       /**< Bit offset of its first key in the key stream. */
+	uint64_t keys;          /**< Keys output before the run. */
+};
+
+/*
+ * Streams of a chunk and their prefix sums, shared by all the threads
+ * decoding it.
+ */
+struct chunkStreams {
+	const unsigned char *metaBytes; /**< Count stream. */
+	uint64_t metaSize;              /**< Size of the count stream in bytes. */
+	const unsigned char *dataBytes; /**< Key stream. */
+	uint64_t dataSize;              /**< Size of the key stream in bytes. */
+	unsigned char *outBuf;          /**< Output buffer of the chunk. */
+	unsigned char countCoding;      /**< Coding of the count stream. */
+	unsigned char runLen;           /**< Bit length of a fixed-width count. */
+	unsigned char keyLen;           /**< Bit length of a key. */
+	uint64_t numRuns;               /**< Number of runs in the chunk. */
+	struct checkpoint *checkpoints; /**< Prefix sums every CHECKPOINT_RUNS runs. */
+};
+
+/*
+ * Range of output keys decoded by one thread. Both ends are on a byte
+ * boundary of the output, so no two threads ever write the same byte.
+ */
+struct chunkPart {
+	struct chunkStreams *streams;   /**< The chunk. */
+	uint64_t firstKey;              /**< First key to decode. */
+	uint64_t endKey;                /**< Key after the last one to decode. */
+};
+
+#ifdef __SSE2__
+// Fills [done, total) of dst with non-temporal stores, copying the pattern
+// found period bytes behind. period is a multiple of 16 and of the key size,
+// at most 128, and done >= period.
+static uint64_t streamFill(unsigned char *dst, uint64_t done, uint64_t total,
+			   unsigned int period)
+{
+	__m128i pattern[8];
+	unsigned int align = (16 - (uintptr_t)(dst + done) % 16) % 16;
+
+	// Plain copy up to the first aligned address
+	memcpy(dst + done, dst + done - period, align);
+	done += align;
+
+	for (unsigned int j = 0; j < period / 16; ++j)
+		pattern[j] = _mm_loadu_si128(
+			(const __m128i *)(dst + done - period + j * 16));
+
+	for (; total - done >= period; done += period)
+		for (unsigned int j = 0; j < period / 16; ++j)
+			_mm_stream_si128((__m128i *)(dst + done + j * 16),
+					 pattern[j]);
+
+	_mm_sfence();
+	return done;
+}
+#endif
 
-void getMetaData(FILE *meta, FILE *data, unsigned char *mUsed,
-		 unsigned char *dUsed, unsigned char *mCur, unsigned char *dCur,
-		 unsigned char *runLen, unsigned char *keyLen,
-		 uint64_t *numRuns)
+// Writes count copies of a keyBytes bytes key
+static void fillBytes(unsigned char *dst, uint64_t key, unsigned int keyBytes,
+		      uint64_t count)
 {
-	// gets data out of the beginning of the meta, data files on the bit
-	// lengths of keys and the number of runs
-	*mUsed = *dUsed = 0;
-	*mCur = fgetc(meta);
-	*dCur = fgetc(data);
+	uint64_t total = count * keyBytes, done = keyBytes;
+
+	if (keyBytes == 1 && total < STREAM_FILL_BYTES) {
+		memset(dst, key, total);
+		return;
+	}
+
+	// Write the key once, then keep doubling it
+	for (unsigned int i = 0; i < keyBytes; ++i)
+		dst[i] = key >> (8 * (keyBytes - 1 - i));
+
+	while (done < total && done < FILL_BLOCK) {
+		uint64_t c = min(done, total - done);
 
-	unsigned char tagSize = 8; // THIS IS INEFFICIENT BUT TIME
-	unsigned char numRunSize = 48;
+		memcpy(dst + done, dst, c);
+		done += c;
+	}
+
+	// Copies are taken a whole number of keys behind, so they stay in
+	// phase with the pattern
+	uint64_t block = done;
+
+#ifdef __SSE2__
+	if (total - done >= STREAM_FILL_BYTES) {
+		block = 16 * keyBytes;
+		done = streamFill(dst, done, total, block);
+	}
+#endif
 
-	*numRuns = get(meta, mUsed, mCur, numRunSize);
-	*runLen = (char)get(meta, mUsed, mCur, tagSize);
-	*keyLen = (char)get(data, dUsed, dCur, tagSize);
+	// Copy the last block written, still in cache, over the rest of the run
+	while (done < total) {
+		uint64_t c = min(block, total - done);
+
+		memcpy(dst + done, dst + done - block, c);
+		done += c;
+	}
+}
+
+// The first 64 bits of a stream of back to back copies of a keyLen bits key,
+// starting phase bits into the key
+static uint64_t patternAt(uint64_t key, unsigned int keyLen,
+			  unsigned int phase)
+{
+	uint64_t left = key << (64 - keyLen);
+	uint64_t word = left << phase;
+
+	for (unsigned int got = keyLen - phase; got < 64; got += keyLen)
+		word |= left >> got;
+
+	return word;
 }
 
-void decompress(FILE *meta, FILE *data, FILE *out, unsigned char *mUsed,
-		unsigned char *dUsed, unsigned char *mCur, unsigned char *dCur,
-		unsigned char runLen, unsigned char keyLen, uint64_t numRuns)
+// Writes the bits of a run of keys shorter than a byte, or of any other size
+// not a multiple of 8, a whole output word at a time. The run repeats every
+// keyLen bits, so the words written repeat every keyLen / gcd(keyLen, 64)
+// words: a single all-zero or all-one word for 1-bit keys, a single word for
+// 2 and 4 bits, a few rotated ones for 3, 5 or 12 bits.
+static void fillBits(struct bitWriter *out, uint64_t key, unsigned int keyLen,
+		     uint64_t count)
+{
+	uint64_t words[64];
+	unsigned int period = keyLen / (keyLen & -keyLen);
+	uint64_t bits = count * keyLen;
+	unsigned int room = 64 - out->accBits, phase;
+	uint64_t full, j;
+
+	// Top the register up and store it, out is then word-aligned again
+	// in the run
+	out->acc |= patternAt(key, keyLen, 0) >> out->accBits;
+	storeBigEndian64(out->out + out->pos, out->acc);
+	out->pos += 8;
+	bits -= room;
+	phase = room % keyLen;
+
+	for (j = 0; j < period; ++j)
+		words[j] = patternAt(key, keyLen, (phase + 64 * j) % keyLen);
+
+	full = bits / 64;
+	for (j = 0; j < full; ++j) {
+		storeBigEndian64(out->out + out->pos, words[j % period]);
+		out->pos += 8;
+	}
+
+	// What is left of the run stays in the register
+	out->accBits = bits % 64;
+	out->acc = out->accBits ? words[full % period] &
+					  ~(~0ULL >> out->accBits) :
+				  0;
+}
+
+// Writes count copies of a keyLen bits key
+static void putRun(struct bitWriter *out, uint64_t key, unsigned int keyLen,
+		   uint64_t count)
+{
+	// Byte-aligned keys leave the writer on a byte boundary, so long runs
+	// can go straight to the buffer
+	if (keyLen % 8 == 0 && count * (keyLen / 8) >= FILL_MIN_BYTES) {
+		flushBits(out);
+		fillBytes(out->out + out->pos, key, keyLen / 8, count);
+		out->pos += count * (keyLen / 8);
+		return;
+	}
+
+	// Other key sizes fill whole words with the periodic pattern
+	if (keyLen % 8 && count * keyLen >= FILL_MIN_BITS) {
+		fillBits(out, key, keyLen, count);
+		return;
+	}
+
+	for (uint64_t j = 0; j < count; ++j)
+		putBits(out, key, keyLen);
+}
+
+// Copies a series of count unique keys from the key stream to the output.
+// Byte-aligned keys are a plain memcpy() from the stream, other sizes move
+// 56 bits at a time.
+static void copyKeys(struct bitReader *data, struct bitWriter *out,
+		     unsigned int keyLen, uint64_t count)
+{
+	uint64_t bits = count * keyLen, from = bitsRead(data);
+
+	if (keyLen % 8 == 0 && from / 8 + bits / 8 <= data->size) {
+		flushBits(out);
+		memcpy(out->out + out->pos, data->buff + from / 8, bits / 8);
+		out->pos += bits / 8;
+		seekBits(data, from + bits);
+		return;
+	}
+
+	for (; bits >= 56; bits -= 56)
+		putBits(out, readBits(data, 56), 56);
+	if (bits > 0)
+		putBits(out, readBits(data, bits), bits);
+}
+
+/*
+ * Decodes at most numKeys keys from the next numRuns runs of the streams.
+ * The first skip keys of the first run were decoded by someone else.
+ * Returns -1 unless the runs hold exactly numKeys keys, the ones past
+ * numKeys being left out.
+ */
+static int decodeKeys(struct countReader *meta, struct bitReader *data,
+		       struct bitWriter *out, unsigned char keyLen,
+		       uint64_t numRuns, uint64_t skip, uint64_t numKeys)
 {
 	// iterates throuh meta to find a run length, then through data for that
 	// length. continues for numRuns iterations through meta.
-	uint64_t run, key, i, j, k;
-	unsigned char oCur;
-	unsigned char oUsed = 0;
+	uint64_t run, key, j, k;
+	int err = 0;
 
-	for (k = 0; k < numRuns; ++k) {
-		run = get(meta, mUsed, mCur, runLen);
+	for (k = 0; k < numRuns && numKeys > 0; ++k) {
+		run = readCount(meta);
 		// escape code indicating a series of unique keys
 		if (run == 0) {
-			run = get(meta, mUsed, mCur, runLen);
-			//++k;
-			for (j = 0; j < run; ++j) {
-				// iterate through unique keys, writing them to the file
-				key = get(data, dUsed, dCur, keyLen);
-				//printf("key: %" PRIx64 "\n", key);
-				put(out, key, &oUsed, &oCur, keyLen);
+			run = readCount(meta) - skip;
+			if (run > numKeys)
+				err = -1;
+			run = min(run, numKeys);
+			if (run * keyLen >= COPY_MIN_BITS) {
+				copyKeys(data, out, keyLen, run);
+			} else {
+				for (j = 0; j < run; ++j) {
+					// iterate through unique keys, writing
+					// them to the file
+					key = readBits(data, keyLen);
+					putBits(out, key, keyLen);
+				}
 			}
 		}
 		// "proper" run (repetition of the same key)
 		else {
-			key = get(data, dUsed, dCur, keyLen);
-			//printf("key: %" PRIx64 "\n", key);
-			for (j = 0; j < run; ++j) {
-				// write the key as many times as the meta file says to
-				put(out, key, &oUsed, &oCur, keyLen);
-			}
+			// write the key as many times as the meta file says to
+			key = readBits(data, keyLen);
+			if (run - skip > numKeys)
+				err = -1;
+			run = min(run - skip, numKeys);
+			putRun(out, key, keyLen, run);
+		}
+
+		skip = 0;
+		numKeys -= run;
+	}
+
+	flushBits(out);
+	return k < numRuns || numKeys > 0 ? -1 : err;
+}
+
+// Walks the whole count stream once, taking a checkpoint every
+// CHECKPOINT_RUNS runs. Returns the number of keys in the chunk.
+static uint64_t scanRuns(struct chunkStreams *streams)
+{
+	struct countReader meta;
+	uint64_t run, dataBit = 0, keys = 0;
+
+	initCountReader(&meta, streams->metaBytes, streams->metaSize,
+			streams->countCoding, streams->runLen);
+
+	for (uint64_t k = 0; k < streams->numRuns; ++k) {
+		if (k % CHECKPOINT_RUNS == 0) {
+			struct checkpoint *cp =
+				&streams->checkpoints[k / CHECKPOINT_RUNS];
+
+			cp->run = k;
+			cp->metaPos = countsRead(&meta);
+			cp->dataBit = dataBit;
+			cp->keys = keys;
+		}
+
+		run = readCount(&meta);
+		if (run == 0) {
+			run = readCount(&meta);
+			dataBit += run * streams->keyLen;
+		} else {
+			dataBit += streams->keyLen;
 		}
+		keys += run;
+	}
+
+	return keys;
+}
+
+// Decodes one part of a chunk, starting from the closest checkpoint
+static void *decodePart(void *arg)
+{
+	struct chunkPart *part = arg;
+	struct chunkStreams *streams = part->streams;
+	struct countReader meta;
+	struct bitReader data;
+	struct bitWriter out;
+	struct countPos entry = { 0, 0 };
+	uint64_t lo = 0, hi = (streams->numRuns - 1) / CHECKPOINT_RUNS;
+	uint64_t run = 0, k, keys, dataBit;
+
+	if (part->firstKey >= part->endKey)
+		return NULL;
+
+	// Last checkpoint at or before our first key
+	while (lo < hi) {
+		uint64_t mid = (lo + hi + 1) / 2;
+
+		if (streams->checkpoints[mid].keys <= part->firstKey)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	k = streams->checkpoints[lo].run;
+	keys = streams->checkpoints[lo].keys;
+	dataBit = streams->checkpoints[lo].dataBit;
+
+	initCountReader(&meta, streams->metaBytes, streams->metaSize,
+			streams->countCoding, streams->runLen);
+	seekCounts(&meta, streams->checkpoints[lo].metaPos);
+
+	// Find the run holding our first key
+	int unique = 0;
+
+	for (; k < streams->numRuns; ++k) {
+		entry = countsRead(&meta);
+		run = readCount(&meta);
+		unique = run == 0;
+		if (unique)
+			run = readCount(&meta);
+
+		if (keys + run > part->firstKey)
+			break;
+
+		keys += run;
+		dataBit += unique ? run * streams->keyLen : streams->keyLen;
+	}
+
+	if (k == streams->numRuns)
+		return NULL;
+
+	// Start over at that run, past the keys the part before us decoded
+	uint64_t skip = part->firstKey - keys;
+
+	seekCounts(&meta, entry);
+	initBitReader(&data, streams->dataBytes, streams->dataSize);
+	seekBits(&data, dataBit + (unique ? skip * streams->keyLen : 0));
+	initBitWriter(&out, streams->outBuf +
+				    part->firstKey * streams->keyLen / 8);
+
+	// A run going past our last key is finished by the next part, the
+	// total number of keys was checked by scanRuns()
+	decodeKeys(&meta, &data, &out, streams->keyLen, streams->numRuns - k,
+		   skip, part->endKey - part->firstKey);
+
+	return NULL;
+}
+
+/*
+ * Decodes a chunk on numParts threads. The prefix sums of the run lengths
+ * give every thread where to start in both streams and in the output, then
+ * all of them decode their share of the keys straight into place.
+ */
+static int decompressParts(struct chunkStreams *streams, uint64_t maxKeys,
+			   int numParts)
+{
+	uint64_t numCheckpoints =
+		(streams->numRuns + CHECKPOINT_RUNS - 1) / CHECKPOINT_RUNS;
+	struct chunkPart *parts = malloc(sizeof(*parts) * numParts);
+	pthread_t *threads = malloc(sizeof(*threads) * numParts);
+	int *started = calloc(numParts, sizeof(int));
+	int err = 0;
+
+	streams->checkpoints = malloc(sizeof(struct checkpoint) *
+				      (numCheckpoints + 1));
+
+	if (!parts || !threads || !started || !streams->checkpoints) {
+		err = -1;
+		goto out;
+	}
+
+	uint64_t numKeys = scanRuns(streams);
+
+	// Counts not adding up to the chunk would overflow the output, or
+	// leave part of it undecoded
+	if (numKeys != maxKeys) {
+		err = -1;
+		goto out;
+	}
+
+	// Parts start on the first key after an equal share of the output
+	// that falls on a byte boundary
+	unsigned int lowBit = streams->keyLen & -streams->keyLen;
+	uint64_t unit = 8 / (lowBit > 8 ? 8 : lowBit);
+
+	for (int t = 0; t < numParts; ++t) {
+		uint64_t first = numKeys * t / numParts;
+
+		parts[t].streams = streams;
+		parts[t].firstKey = min((first + unit - 1) / unit * unit,
+					numKeys);
+		if (t > 0)
+			parts[t - 1].endKey = parts[t].firstKey;
 	}
+	parts[numParts - 1].endKey = numKeys;
+
+	// Whatever cannot be handed to a thread is decoded here
+	for (int t = 1; t < numParts; ++t)
+		started[t] = !pthread_create(&threads[t], NULL, decodePart,
+					     &parts[t]);
+
+	for (int t = 0; t < numParts; ++t)
+		if (!started[t])
+			decodePart(&parts[t]);
+
+	for (int t = 1; t < numParts; ++t)
+		if (started[t])
+			pthread_join(threads[t], NULL);
+
+out:
+	free(streams->checkpoints);
+	free(parts);
+	free(threads);
+	free(started);
+	return err;
+}
+
+int decompressChunk(struct archive *ar, uint64_t idx, unsigned char *outBuf,
+		    int numThreads)
+{
+	struct chunkHeader hdr;
+	struct countReader meta;
+	struct bitReader data;
+	unsigned char *streams = NULL, *metaDecoded = NULL, *dataDecoded = NULL;
+	unsigned char *dataExpanded = NULL;
+	const unsigned char *metaBytes, *dataBytes;
+	uint64_t metaSize, dataSize;
+	int err = 0;
+
+	if (readChunkHeader(ar, idx, &hdr))
+		return -1;
+
+	if (ar->map) {
+		metaBytes = ar->map + hdr.metaOffset;
+		dataBytes = ar->map + hdr.dataOffset;
+	} else {
+		// No mapping, read both streams of the chunk in one go
+		uint64_t bytes = hdr.metaBytes + hdr.dataBytes;
+
+		streams = malloc(bytes + 1);
+		if (!streams || fseek(ar->file, hdr.metaOffset, SEEK_SET) ||
+		    fread(streams, 1, bytes, ar->file) != bytes) {
+			free(streams);
+			return -1;
+		}
+
+		metaBytes = streams;
+		dataBytes = streams + hdr.metaBytes;
+	}
+
+	metaSize = hdr.metaBytes;
+	dataSize = hdr.dataBytes;
+
+	// Undo the Huffman stage first, the runs are then decoded from the
+	// plain streams
+	if (hdr.entropy & ENTROPY_META) {
+		if (huffmanDecode(metaBytes, metaSize, &metaDecoded, &metaSize))
+			err = -1;
+		metaBytes = metaDecoded;
+	}
+
+	if (!err && (hdr.entropy & ENTROPY_DATA)) {
+		if (huffmanDecode(dataBytes, dataSize, &dataDecoded, &dataSize))
+			err = -1;
+		dataBytes = dataDecoded;
+	}
+
+	// Keys the chunk holds, a last one cut by the end of the chunk
+	// included
+	uint64_t rawSize = ar->index[idx].rawSize;
+	uint64_t maxKeys = (rawSize * 8 + hdr.keyLen - 1) / hdr.keyLen;
+
+	// Then look the keys up in the palette, if the chunk has one
+	if (!err && hdr.paletteSize > 0) {
+		if (paletteDecode(dataBytes, dataSize, hdr.paletteSize,
+				  hdr.keyLen, maxKeys,
+				  &dataExpanded, &dataSize))
+			err = -1;
+		dataBytes = dataExpanded;
+	}
+
+	if (err) {
+		free(streams);
+		free(metaDecoded);
+		free(dataDecoded);
+		return -1;
+	}
+
+	// Small chunks are not worth waking threads up for
+	uint64_t maxParts = rawSize / THREAD_MIN_BYTES;
+
+	if (numThreads > 1 && maxParts > 1 && hdr.numRuns > 0) {
+		struct chunkStreams chunk = {
+			.metaBytes = metaBytes,
+			.metaSize = metaSize,
+			.dataBytes = dataBytes,
+			.dataSize = dataSize,
+			.outBuf = outBuf,
+			.countCoding = hdr.countCoding,
+			.runLen = hdr.runLen,
+			.keyLen = hdr.keyLen,
+			.numRuns = hdr.numRuns,
+		};
+
+		err = decompressParts(&chunk, maxKeys,
+				      (int)min((uint64_t)numThreads, maxParts));
+	} else {
+		initCountReader(&meta, metaBytes, metaSize, hdr.countCoding,
+				hdr.runLen);
+		initBitReader(&data, dataBytes, dataSize);
+
+		err = decompress(&meta, &data, outBuf, hdr.keyLen, hdr.numRuns,
+				 maxKeys);
+	}
+
+	free(streams);
+	free(metaDecoded);
+	free(dataDecoded);
+	free(dataExpanded);
+	return err;
+}
+
+int decompress(struct countReader *meta, struct bitReader *data,
+	       unsigned char *outBuf, unsigned char keyLen, uint64_t numRuns,
+	       uint64_t maxKeys)
+{
+	struct bitWriter out;
+
+	initBitWriter(&out, outBuf);
+	return decodeKeys(meta, data, &out, keyLen, numRuns, 0, maxKeys);
 }
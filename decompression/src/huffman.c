@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: GPL-3.0
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/bitReader.h"
+#include "../include/container.h"
+#include "../include/huffman.h"
+
+// Number of entries of the decoding tables
+#define TABLE_SIZE (1U << HUFFMAN_MAX_BITS)
+
+// A table entry packs up to two byte values, how many of them there are
+// and the bits they take
+#define ENTRY(s1, s2, n, bits) \
+	((uint32_t)(s1) | (uint32_t)(s2) << 8 | (uint32_t)(n) << 16 | \
+	 (uint32_t)(bits) << 20)
+
+// Builds the table resolving one or two codes per lookup from the code
+// lengths. Returns -1 if the lengths do not make a valid code.
+static int buildTable(const unsigned char len[256], uint32_t *table)
+{
+	uint16_t single[TABLE_SIZE];
+	uint32_t code = 0, used = 0;
+
+	// Bits no code starts with only appear in corrupted streams, they
+	// decode as 0 and use up a whole lookup
+	for (unsigned int i = 0; i < TABLE_SIZE; ++i)
+		single[i] = HUFFMAN_MAX_BITS << 8;
+
+	// Canonical codes: shorter first, then in byte order
+	for (unsigned int l = 1; l <= HUFFMAN_MAX_BITS; ++l) {
+		for (unsigned int s = 0; s < 256; ++s) {
+			if (len[s] != l)
+				continue;
+
+			uint32_t span = 1U << (HUFFMAN_MAX_BITS - l);
+
+			used += span;
+			if (used > TABLE_SIZE)
+				return -1;
+
+			for (uint32_t i = 0; i < span; ++i)
+				single[code * span + i] = s | l << 8;
+			++code;
+		}
+		code <<= 1;
+	}
+
+	// Pair every code up with the one after it if that fits too
+	for (unsigned int i = 0; i < TABLE_SIZE; ++i) {
+		unsigned int l1 = single[i] >> 8;
+		unsigned int next = (i << l1) & (TABLE_SIZE - 1);
+		unsigned int l2 = single[next] >> 8;
+
+		if (l1 + l2 <= HUFFMAN_MAX_BITS)
+			table[i] = ENTRY(single[i] & 0xFF, single[next] & 0xFF,
+					 2, l1 + l2);
+		else
+			table[i] = ENTRY(single[i] & 0xFF, 0, 1, l1);
+	}
+
+	return 0;
+}
+
+// Takes one lookup worth of the stream, writing one or two bytes
+static inline void decodeStep(struct bitReader *reader, const uint32_t *table,
+			      unsigned char *out, uint64_t *pos)
+{
+	uint32_t entry = table[reader->bitBuf >> (64 - HUFFMAN_MAX_BITS)];
+	unsigned int bits = entry >> 20;
+
+	out[*pos] = entry;
+	out[*pos + 1] = entry >> 8;
+	*pos += (entry >> 16) & 3;
+
+	reader->bitBuf <<= bits;
+	reader->bitCount -= bits;
+}
+
+int huffmanDecode(const unsigned char *in, uint64_t size, unsigned char **out,
+		  uint64_t *outSize)
+{
+	unsigned char len[256];
+	uint32_t table[TABLE_SIZE];
+	struct bitReader reader;
+	uint64_t rawSize = 0, pos = 0;
+
+	if (size < HUFFMAN_HEADER_SIZE)
+		return -1;
+
+	for (int i = 0; i < 8; ++i)
+		rawSize = (rawSize << 8) | in[i];
+
+	// Every byte takes at least one bit
+	if (rawSize / 8 > size)
+		return -1;
+
+	for (int i = 0; i < 128; ++i) {
+		len[2 * i] = in[8 + i] >> 4;
+		len[2 * i + 1] = in[8 + i] & 0xF;
+	}
+
+	if (buildTable(len, table))
+		return -1;
+
+	// Room for the second byte of the last lookup
+	*out = malloc(rawSize + 8);
+	if (!*out)
+		return -1;
+
+	initBitReader(&reader, in + HUFFMAN_HEADER_SIZE,
+		      size - HUFFMAN_HEADER_SIZE);
+
+	// A refill gives at least 56 bits, enough for four lookups
+	while (rawSize - pos >= 8) {
+		refillBits(&reader);
+		decodeStep(&reader, table, *out, &pos);
+		decodeStep(&reader, table, *out, &pos);
+		decodeStep(&reader, table, *out, &pos);
+		decodeStep(&reader, table, *out, &pos);
+	}
+
+	while (pos < rawSize) {
+		if (reader.bitCount < HUFFMAN_MAX_BITS)
+			refillBits(&reader);
+		decodeStep(&reader, table, *out, &pos);
+	}
+
+	*outSize = rawSize;
+	return 0;
+}
@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: GPL-3.0
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../include/bitReader.h"
+#include "../include/bitWriter.h"
+#include "../include/common.h"
+#include "../include/container.h"
+#include "../include/palette.h"
+
+int paletteDecode(const unsigned char *in, uint64_t size,
+		  unsigned int paletteSize, unsigned int keyLen,
+		  uint64_t maxKeys, unsigned char **out, uint64_t *outSize)
+{
+	struct bitReader reader;
+	struct bitWriter writer;
+	uint64_t table[PALETTE_MAX] = { 0 };
+	uint64_t paletteBits = (uint64_t)paletteSize * keyLen;
+	unsigned int indexBits = 1;
+
+	if (paletteSize == 0 || paletteSize > PALETTE_MAX ||
+	    paletteBits > size * 8)
+		return -1;
+
+	while ((1U << indexBits) < paletteSize)
+		++indexBits;
+
+	initBitReader(&reader, in, size);
+	for (unsigned int i = 0; i < paletteSize; ++i)
+		table[i] = readBits(&reader, keyLen);
+
+	// The padding of the last byte may pass for a few more indices, they
+	// are expanded too and never read
+	uint64_t numKeys = min((size * 8 - paletteBits) / indexBits, maxKeys);
+
+	*out = malloc(numKeys * keyLen / 8 + 16);
+	if (!*out)
+		return -1;
+
+	initBitWriter(&writer, *out);
+	for (uint64_t i = 0; i < numKeys; ++i)
+		putBits(&writer, table[readBits(&reader, indexBits)], keyLen);
+	flushBits(&writer);
+
+	*outSize = writer.pos;
+	return 0;
+}
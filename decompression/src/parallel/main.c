@@ -1,7 +1,6 @@
 // SPDX-License-Identifier: GPL-3.0
 
 #include <inttypes.h>
-#include <math.h>
 #include <mpi.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -9,119 +8,173 @@
 #include <string.h>
 #include <sys/time.h>
 
-#include "../../include/mpi_common.h"
-#include "../../include/mpi_decompressor.h"
+#include "../../include/common.h"
+#include "../../include/container.h"
+#include "../../include/decompressor.h"
+
+// MPI-IO counts are ints, so bigger slices are written in several rounds
+#define MPI_IO_MAX_BYTES (1UL << 30)
+
+/*
+ * Writes buf to [offset, offset + size) of the file using collective MPI-IO.
+ * Every rank must call this, ranks with nothing to write pass a size of 0.
+ * Returns 0 on success and -1 if this rank failed.
+ */
+static int writeSliceMPI(MPI_File fh, uint64_t offset, uint64_t size,
+			 unsigned char *buf)
+{
+	MPI_Status status;
+	uint64_t myRounds, rounds, done = 0;
+	int err = 0;
+
+	// Ranks with less to write still have to join every collective call
+	myRounds = (size + MPI_IO_MAX_BYTES - 1) / MPI_IO_MAX_BYTES;
+	MPI_Allreduce(&myRounds, &rounds, 1, MPI_UINT64_T, MPI_MAX,
+		      MPI_COMM_WORLD);
+
+	for (uint64_t r = 0; r < rounds; ++r) {
+		int count = (int)min(size - done, MPI_IO_MAX_BYTES);
+		int put = 0;
+
+		if (MPI_File_write_at_all(fh, (MPI_Offset)(offset + done),
+					  buf + done, count, MPI_UNSIGNED_CHAR,
+					  &status) != MPI_SUCCESS)
+			err = 1;
+		else
+			MPI_Get_count(&status, MPI_UNSIGNED_CHAR, &put);
+
+		if (put != count)
+			err = 1;
+
+		done += count;
+	}
+
+	return err ? -1 : 0;
+}
 
 int main(int argc, char **argv)
 {
-	if (argc != 3) {
-		printf("usage: ./decompress [input name] [output name]\n");
+	int numThreads = takeThreadsOption(&argc, argv);
+
+	if (argc != 3 || numThreads < 1) {
+		printf("usage: ./decompress [archive name] [output name] [--threads N]\n");
 		return -1;
 	}
 
-	// initialize MPI
+	// initialize MPI, only the main thread of a rank makes MPI calls
 
-	int nProc, rank;
+	int nProc, rank, threadLevel;
 
-	MPI_Init(NULL, NULL);
+	MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &threadLevel);
 	MPI_Comm_size(MPI_COMM_WORLD, &nProc);
 	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
+	// Worker threads are only safe if MPI gave the thread level asked for
+	if (numThreads > 1 && threadLevel < MPI_THREAD_FUNNELED) {
+		if (rank == 0)
+			printf("WARNING: MPI has no thread support, using one thread per process\n");
+		numThreads = 1;
+	}
+
 	struct timeval tvStart, tvEnd;
 
 	if (rank == 0)
 		gettimeofday(&tvStart, 0);
 
-	char rankStr[10];
-	int rankLen = sprintf(rankStr, "%i", rank);
-
-	// get input files
-	char *dataName = malloc(strlen(argv[1]) + 5 + rankLen);
-	char *metaName = malloc(strlen(argv[1]) + 5 + rankLen);
-
-	memmove(dataName, argv[1], strlen(argv[1]));
-	memmove(metaName, argv[1], strlen(argv[1]));
+	// open the archive
+	struct archive ar;
 
-	int i;
-
-	for (i = 0; i < rankLen; ++i) {
-		dataName[strlen(argv[1]) + i] = rankStr[i];
-		metaName[strlen(argv[1]) + i] = rankStr[i];
+	if (openArchive(&ar, argv[1])) {
+		if (rank == 0)
+			printf("ERROR: %s is not a valid archive\n", argv[1]);
+		MPI_Abort(MPI_COMM_WORLD, MPI_ERR_FILE);
 	}
-	dataName[strlen(argv[1]) + rankLen] = '\0';
-	metaName[strlen(argv[1]) + rankLen] = '\0';
-
-	strncat(dataName, ".data", 5);
-	strncat(metaName, ".meta", 5);
 
-	FILE *data = fopen(dataName, "rb");
-	FILE *meta = fopen(metaName, "rb");
+	// every rank decompresses a contiguous range of chunks, so the
+	// archive can be decompressed with any number of processes
+	uint64_t firstChunk = ar.numChunks * rank / nProc;
+	uint64_t lastChunk = ar.numChunks * (rank + 1) / nProc;
+	uint64_t c, maxRaw = 0, myOffset = 0, fileSize = 0;
+
+	if (rank == 0 && (uint64_t)nProc > ar.numChunks)
+		printf("WARNING: %i processes for %" PRIu64
+		       " chunks, some will stay idle\n",
+		       nProc, ar.numChunks);
+
+	// the index gives where every chunk goes in the output
+	for (c = 0; c < ar.numChunks; ++c) {
+		if (c < firstChunk)
+			myOffset += ar.index[c].rawSize;
+		if (c >= firstChunk && c < lastChunk)
+			maxRaw = ar.index[c].rawSize > maxRaw ?
+					 ar.index[c].rawSize :
+					 maxRaw;
+		fileSize += ar.index[c].rawSize;
+	}
 
-	// variables for tracking relevant features of files
-	uint64_t numRuns;
-	unsigned char expProcs, mUsed, dUsed, mCur, dCur, runLen, keyLen;
+	// a single buffer big enough for the largest of our chunks, so memory
+	// use does not grow with the size of the output
+	unsigned char *outBuf = malloc(sizeof(char) * (maxRaw + 8));
 
-	getMetaData(meta, data, &mUsed, &dUsed, &mCur, &dCur, &runLen, &keyLen,
-		    &numRuns, &expProcs);
-	if (nProc != expProcs) {
-		printf("ERROR: expected %i processes, got %i\n", expProcs,
-		       nProc);
-		MPI_Abort(MPI_COMM_WORLD, MPI_ERR_RANK);
+	if (!outBuf) {
+		printf("ERROR: not enough memory for %" PRIu64 " bytes\n",
+		       maxRaw);
+		MPI_Abort(MPI_COMM_WORLD, MPI_ERR_NO_MEM);
 	}
 
-	uint64_t numSlices, run;
+	MPI_File fh;
 
-	numSlices = 0;
-	for (i = 0; i < numRuns; ++i) {
-		run = get(meta, &mUsed, &mCur, runLen);
-		numSlices += run;
+	if (MPI_File_open(MPI_COMM_WORLD, argv[2],
+			  MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+			  &fh) != MPI_SUCCESS) {
+		if (rank == 0)
+			printf("ERROR: could not write output file %s\n",
+			       argv[2]);
+		MPI_Abort(MPI_COMM_WORLD, MPI_ERR_IO);
 	}
-	// reset meta
-	fseek(meta, 8, SEEK_SET);
-	mUsed = 0;
-	mCur = fgetc(meta);
-
-	uint64_t numBits = numSlices * keyLen;
-	uint64_t numBytes = (numBits / 8) + 1;
-	char *outBuf = malloc(sizeof(char) * numBytes);
 
 	if (rank == 0)
 		printf("got metadata, decompressing...\n");
 
-	decompress(meta, data, outBuf, &mUsed, &dUsed, &mCur, &dCur, runLen,
-		   keyLen, numRuns);
+	// In every round each rank decodes its next chunk and all of them
+	// write what they decoded straight to its place in the output
+	uint64_t myRounds = lastChunk - firstChunk, rounds;
+	int err = 0, anyErr;
+
+	MPI_Allreduce(&myRounds, &rounds, 1, MPI_UINT64_T, MPI_MAX,
+		      MPI_COMM_WORLD);
+
+	for (uint64_t r = 0; r < rounds; ++r) {
+		uint64_t size = 0;
+
+		c = firstChunk + r;
+		if (c < lastChunk) {
+			if (decompressChunk(&ar, c, outBuf, numThreads)) {
+				printf("ERROR: could not decompress chunk %" PRIu64
+				       "\n",
+				       c);
+				MPI_Abort(MPI_COMM_WORLD, MPI_ERR_OTHER);
+			}
+			size = ar.index[c].rawSize;
+		}
 
-	MPI_Barrier(MPI_COMM_WORLD);
+		if (writeSliceMPI(fh, myOffset, size, outBuf))
+			err = 1;
+		myOffset += size;
+	}
 
-	if (rank == 0)
-		printf("decompressed, writing...\n");
+	// Drop anything left over from an older, longer file
+	if (MPI_File_set_size(fh, (MPI_Offset)fileSize) != MPI_SUCCESS)
+		err = 1;
 
-	if (rank == 0) {
-		FILE *out = fopen(argv[2], "wb");
-		// write to out file
-		fwrite(outBuf, 1, (numBytes - 1), out); // -1 because of tail
-
-		int inBytes;
-		char *inBuf;
-
-		for (i = 1; i < nProc; ++i) {
-			// recieve from i, write data
-			MPI_Recv(&inBytes, 1, MPI_INT, i, i, MPI_COMM_WORLD,
-				 MPI_STATUS_IGNORE);
-			--inBytes;
-			inBuf = malloc(sizeof(char) * inBytes);
-			MPI_Recv(inBuf, inBytes, MPI_CHAR, i, i, MPI_COMM_WORLD,
-				 MPI_STATUS_IGNORE);
-			fwrite(inBuf, 1, inBytes, out);
-			free(inBuf);
-		}
-		fclose(out);
-	}
-	// send decompressed data back to master for writing
-	else {
-		MPI_Send(&numBytes, 1, MPI_INT, 0, rank, MPI_COMM_WORLD);
-		MPI_Send(outBuf, (numBytes - 1), MPI_CHAR, 0, rank,
-			 MPI_COMM_WORLD);
+	MPI_File_close(&fh);
+
+	MPI_Allreduce(&err, &anyErr, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+	if (anyErr) {
+		if (rank == 0)
+			printf("ERROR: could not write output file %s\n",
+			       argv[2]);
+		MPI_Abort(MPI_COMM_WORLD, MPI_ERR_IO);
 	}
 
 	if (rank == 0) {
@@ -136,8 +189,7 @@ int main(int argc, char **argv)
 	// tidy up
 	free(outBuf);
 
-	fclose(data);
-	fclose(meta);
+	closeArchive(&ar);
 
 	MPI_Finalize();
 	return 0;
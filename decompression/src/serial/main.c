@@ -8,61 +8,102 @@
 #include <sys/time.h>
 
 #include "../../include/common.h"
+#include "../../include/container.h"
 #include "../../include/decompressor.h"
 
 int main(int argc, char **argv)
 {
-	if (argc != 3) {
-		printf("usage: ./decompress [input name] [output name]\n");
+	int numThreads = takeThreadsOption(&argc, argv);
+
+	if (argc != 3 || numThreads < 1) {
+		printf("usage: ./decompress [archive name] [output name, - for stdout] [--threads N]\n");
 		return -1;
 	}
 
+	// with the output going to stdout, messages go to stderr
+	int toStdout = !strcmp(argv[2], "-");
+	FILE *msg = toStdout ? stderr : stdout;
+
 	struct timeval tvStart, tvEnd;
+	struct archive ar;
+	unsigned char *outBuf = NULL;
+	FILE *out = NULL;
+	int ret = -1;
 
 	gettimeofday(&tvStart, 0);
 
-	// get input files
+	// open the archive
+	if (openArchive(&ar, argv[1])) {
+		fprintf(msg, "ERROR: %s is not a valid archive\n", argv[1]);
+		goto cleanup;
+	}
 
-	/* char* dataName = malloc(sizeof(argv[1]) + 5); */
-	/* char* metaName = malloc(sizeof(argv[1]) + 5); */
-	/* printf("sizeof %s: %i\n", argv[1], strlen(argv[1])); */
-	/* memmove(dataName, argv[1], sizeof(argv[1])); */
-	/* memmove(metaName, argv[1], sizeof(argv[1])); */
-	char *dataName = malloc(strlen(argv[1]) + 5);
-	char *metaName = malloc(strlen(argv[1]) + 5);
+	out = toStdout ? stdout : fopen(argv[2], "wb");
 
-	memmove(dataName, argv[1], strlen(argv[1]));
-	memmove(metaName, argv[1], strlen(argv[1]));
+	if (!out) {
+		fprintf(msg, "ERROR: could not open %s\n", argv[2]);
+		goto cleanup;
+	}
 
-	strcat(dataName, ".data");
-	strcat(metaName, ".meta");
+	// a single buffer big enough for the largest chunk
+	uint64_t i, maxRaw = 0, numRuns = 0;
 
-	FILE *data = fopen(dataName, "rb");
-	FILE *meta = fopen(metaName, "rb");
-	FILE *out = fopen(argv[2], "wb");
+	for (i = 0; i < ar.numChunks; ++i) {
+		maxRaw = ar.index[i].rawSize > maxRaw ? ar.index[i].rawSize :
+							maxRaw;
+		numRuns += ar.index[i].numRuns;
+	}
+
+	// keyLen 0 means every chunk has its own
+	fprintf(msg,
+		"numChunks: %" PRIu64 " | numRuns: %" PRIu64 " | keyLen: %u\n",
+		ar.numChunks, numRuns, ar.keyLen);
 
-	// variables for tracking relevant features of files
-	uint64_t numRuns;
-	unsigned char mUsed, dUsed, mCur, dCur, runLen, keyLen;
+	outBuf = malloc(maxRaw + 8);
 
-	// actually do work
-	getMetaData(meta, data, &mUsed, &dUsed, &mCur, &dCur, &runLen, &keyLen,
-		    &numRuns);
-	printf("numRuns: %" PRIu64 " | runLen: %u | keyLen: %u\n", numRuns,
-	       runLen, keyLen);
-	decompress(meta, data, out, &mUsed, &dUsed, &mCur, &dCur, runLen,
-		   keyLen, numRuns);
+	if (!outBuf) {
+		fprintf(msg,
+			"ERROR: not enough memory for a %" PRIu64
+			" bytes chunk\n",
+			maxRaw);
+		goto cleanup;
+	}
+
+	// actually do work, one chunk at a time. Each chunk is handed to the
+	// output as soon as it is decoded, so memory use is bounded by the
+	// largest chunk whatever the size of the output.
+	for (i = 0; i < ar.numChunks; ++i) {
+		if (decompressChunk(&ar, i, outBuf, numThreads)) {
+			fprintf(msg, "ERROR: could not read chunk %" PRIu64 "\n",
+				i);
+			goto cleanup;
+		}
+
+		if (fwrite(outBuf, 1, ar.index[i].rawSize, out) !=
+		    ar.index[i].rawSize) {
+			fprintf(msg, "ERROR: could not write %s\n", argv[2]);
+			goto cleanup;
+		}
+	}
+
+	if (fflush(out)) {
+		fprintf(msg, "ERROR: could not write %s\n", argv[2]);
+		goto cleanup;
+	}
 
 	struct timeval elapsedTime;
 
 	gettimeofday(&tvEnd, 0);
 	subtractTime(&tvStart, &tvEnd, &elapsedTime);
-	printf("Elapsed time: %ld.%ld06\n", elapsedTime.tv_sec,
-	       elapsedTime.tv_usec);
-
-	// tidy up
-	fclose(data);
-	fclose(meta);
-	fclose(out);
-	return 0;
+	fprintf(msg, "Elapsed time: %ld.%ld06\n", elapsedTime.tv_sec,
+		elapsedTime.tv_usec);
+	ret = 0;
+
+	// tidy up, on success or not
+cleanup:
+	free(outBuf);
+	closeArchive(&ar);
+	if (out)
+		fclose(out);
+	return ret;
 }